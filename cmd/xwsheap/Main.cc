@@ -0,0 +1,500 @@
+/*
+ * xwsheap: reads heap snapshots written by xwshost's heapSnapshot() and
+ * reports what is retaining the heap.
+ *
+ * With one snapshot, it reports for each kind of object and each allocation
+ * site the count and size of those objects and what they retain - what would
+ * be freed were they gone - and the objects which retain the most. An object
+ * retains those it dominates in the graph of strong references from the
+ * roots; dominators are found as described in Cooper, Harvey and Kennedy, "A
+ * Simple, Fast Dominance Algorithm". With two, it reports how the count and
+ * size of each kind and site changed from the first to the second, which is
+ * where a leak shows itself; objects move, so they cannot be matched up one
+ * by one.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "HeapSnapshot.hh"
+
+static const size_t kNone = ~(size_t)0;
+
+struct Node {
+	uintptr_t m_addr;
+	std::string m_kind;
+	size_t m_size;
+	unsigned m_site;
+	/** Strong references, as addresses until resolved to indices. */
+	std::vector<uintptr_t> m_refs;
+};
+
+struct Totals {
+	size_t m_count;
+	size_t m_size;
+	size_t m_retained;
+
+	Totals() : m_count(0), m_size(0), m_retained(0) {}
+};
+
+/**
+ * A heap snapshot. Node 0 is a pseudo-object with an edge to each root, so
+ * that the graph has a single entry.
+ */
+struct Snapshot {
+	std::vector<Node> m_nodes;
+	std::map<unsigned, std::string> m_sites;
+
+	/** Depth-first postorder number of each node; kNone if unreachable. */
+	std::vector<size_t> m_post;
+	/** Immediate dominator of each reachable node. */
+	std::vector<size_t> m_idom;
+	std::vector<size_t> m_retained;
+
+	std::map<std::string, Totals> m_kinds;
+	std::map<std::string, Totals> m_bySite;
+	Totals m_unreachable;
+
+	bool read(const char *path);
+	void analyse();
+
+	std::string siteName(unsigned site) const;
+
+    private:
+	void resolve();
+	void number(std::vector<size_t> &order);
+	void findDominators(const std::vector<size_t> &order);
+	void total();
+};
+
+bool
+Snapshot::read(const char *path)
+{
+	std::ifstream in(path);
+	std::string line;
+	std::vector<uintptr_t> roots;
+
+	if (!in) {
+		fprintf(stderr, "xwsheap: %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	if (!std::getline(in, line) || line != XWS_SNAPSHOT_MAGIC) {
+		fprintf(stderr, "xwsheap: %s: not a heap snapshot\n", path);
+		return false;
+	}
+
+	m_nodes.push_back(Node());
+	m_nodes[0].m_addr = 0;
+	m_nodes[0].m_kind = "(roots)";
+	m_nodes[0].m_size = 0;
+	m_nodes[0].m_site = 0;
+
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		std::string what, ref;
+
+		fields >> what;
+		if (what == "object") {
+			Node node;
+
+			fields >> std::hex >> node.m_addr >> std::dec >>
+			    node.m_kind >> node.m_size >> node.m_site;
+			while (fields >> ref)
+				/* weak references retain nothing */
+				if (ref[0] != '~')
+					node.m_refs.push_back(
+					    strtoul(ref.c_str(), NULL, 16));
+			m_nodes.push_back(node);
+		} else if (what == "root") {
+			uintptr_t addr;
+
+			fields >> std::hex >> addr;
+			roots.push_back(addr);
+		} else if (what == "site") {
+			unsigned id;
+			std::string name;
+
+			fields >> id >> name;
+			m_sites[id] = name;
+		} else if (!what.empty()) {
+			fprintf(stderr, "xwsheap: %s: bad record \"%s\"\n",
+			    path, what.c_str());
+			return false;
+		}
+		if (fields.bad()) {
+			fprintf(stderr, "xwsheap: %s: bad line \"%s\"\n", path,
+			    line.c_str());
+			return false;
+		}
+	}
+
+	m_nodes[0].m_refs = roots;
+	resolve();
+	return true;
+}
+
+/*
+ * A root or reference may be ambiguous, or into the interior of an object,
+ * so each is resolved to the object containing it, if any.
+ */
+void
+Snapshot::resolve()
+{
+	std::map<uintptr_t, size_t> byAddr;
+
+	for (size_t i = 1; i < m_nodes.size(); i++)
+		byAddr[m_nodes[i].m_addr] = i;
+
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		std::vector<uintptr_t> &refs = m_nodes[i].m_refs;
+		size_t n = 0;
+
+		for (size_t j = 0; j < refs.size(); j++) {
+			std::map<uintptr_t, size_t>::iterator it =
+			    byAddr.upper_bound(refs[j]);
+
+			if (it == byAddr.begin())
+				continue;
+			--it;
+			if (refs[j] - it->first <
+			    m_nodes[it->second].m_size)
+				refs[n++] = it->second;
+		}
+		refs.resize(n);
+	}
+}
+
+/* Iteratively, lest a long list overflow the stack. */
+void
+Snapshot::number(std::vector<size_t> &order)
+{
+	std::vector<std::pair<size_t, size_t> > stack;
+
+	m_post.assign(m_nodes.size(), kNone);
+	/* marks a node as visited until it is numbered */
+	m_post[0] = kNone - 1;
+	stack.push_back(std::make_pair(0, 0));
+
+	while (!stack.empty()) {
+		size_t node = stack.back().first;
+		size_t &edge = stack.back().second;
+
+		if (edge < m_nodes[node].m_refs.size()) {
+			size_t next = m_nodes[node].m_refs[edge++];
+
+			if (m_post[next] == kNone) {
+				m_post[next] = kNone - 1;
+				stack.push_back(std::make_pair(next, 0));
+			}
+		} else {
+			m_post[node] = order.size();
+			order.push_back(node);
+			stack.pop_back();
+		}
+	}
+}
+
+void
+Snapshot::findDominators(const std::vector<size_t> &order)
+{
+	std::vector<std::vector<size_t> > preds(m_nodes.size());
+	bool changed = true;
+
+	for (size_t i = 0; i < order.size(); i++) {
+		const std::vector<uintptr_t> &refs =
+		    m_nodes[order[i]].m_refs;
+
+		for (size_t j = 0; j < refs.size(); j++)
+			preds[refs[j]].push_back(order[i]);
+	}
+
+	m_idom.assign(m_nodes.size(), kNone);
+	m_idom[0] = 0;
+
+	while (changed) {
+		changed = false;
+
+		/* in reverse postorder, skipping the entry, which is last */
+		for (size_t i = order.size() - 1; i-- > 0;) {
+			size_t node = order[i], idom = kNone;
+
+			for (size_t j = 0; j < preds[node].size(); j++) {
+				size_t a = preds[node][j], b = idom;
+
+				if (m_idom[a] == kNone)
+					continue;
+				if (b == kNone) {
+					idom = a;
+					continue;
+				}
+				while (a != b) {
+					while (m_post[a] < m_post[b])
+						a = m_idom[a];
+					while (m_post[b] < m_post[a])
+						b = m_idom[b];
+				}
+				idom = a;
+			}
+
+			if (m_idom[node] != idom) {
+				m_idom[node] = idom;
+				changed = true;
+			}
+		}
+	}
+}
+
+/*
+ * The totals retained by a kind or site count each object once: only the
+ * objects not dominated by another of the same kind or site are summed. The
+ * dominator tree is walked keeping a count of each on the path to the node.
+ */
+void
+Snapshot::total()
+{
+	std::vector<std::vector<size_t> > children(m_nodes.size());
+	std::vector<std::pair<size_t, size_t> > stack;
+	std::map<std::string, size_t> kindDepth;
+	std::map<unsigned, size_t> siteDepth;
+
+	for (size_t i = 1; i < m_nodes.size(); i++) {
+		const Node &node = m_nodes[i];
+
+		if (m_post[i] == kNone) {
+			m_unreachable.m_count++;
+			m_unreachable.m_size += node.m_size;
+			continue;
+		}
+		children[m_idom[i]].push_back(i);
+
+		m_kinds[node.m_kind].m_count++;
+		m_kinds[node.m_kind].m_size += node.m_size;
+		if (node.m_site) {
+			m_bySite[siteName(node.m_site)].m_count++;
+			m_bySite[siteName(node.m_site)].m_size += node.m_size;
+		}
+	}
+
+	stack.push_back(std::make_pair(0, 0));
+	while (!stack.empty()) {
+		size_t i = stack.back().first;
+		size_t &child = stack.back().second;
+		const Node &node = m_nodes[i];
+
+		if (child == 0 && i != 0) {
+			if (kindDepth[node.m_kind]++ == 0)
+				m_kinds[node.m_kind].m_retained +=
+				    m_retained[i];
+			if (node.m_site && siteDepth[node.m_site]++ == 0)
+				m_bySite[siteName(node.m_site)].m_retained +=
+				    m_retained[i];
+		}
+
+		if (child < children[i].size())
+			stack.push_back(std::make_pair(children[i][child++],
+			    0));
+		else {
+			if (i != 0) {
+				kindDepth[node.m_kind]--;
+				if (node.m_site)
+					siteDepth[node.m_site]--;
+			}
+			stack.pop_back();
+		}
+	}
+}
+
+void
+Snapshot::analyse()
+{
+	std::vector<size_t> order;
+
+	number(order);
+	findDominators(order);
+
+	/* postorder puts each node before its dominator */
+	m_retained.assign(m_nodes.size(), 0);
+	for (size_t i = 0; i < order.size(); i++) {
+		size_t node = order[i];
+
+		m_retained[node] += m_nodes[node].m_size;
+		if (node != 0)
+			m_retained[m_idom[node]] += m_retained[node];
+	}
+
+	total();
+}
+
+std::string
+Snapshot::siteName(unsigned site) const
+{
+	std::map<unsigned, std::string>::const_iterator it =
+	    m_sites.find(site);
+	std::ostringstream name;
+
+	if (it != m_sites.end())
+		return it->second;
+	name << "site " << site;
+	return name.str();
+}
+
+typedef std::pair<std::string, Totals> Row;
+
+static bool
+byRetained(const Row &a, const Row &b)
+{
+	return a.second.m_retained > b.second.m_retained;
+}
+
+static void
+printTable(const char *title, const std::map<std::string, Totals> &totals)
+{
+	std::vector<Row> rows(totals.begin(), totals.end());
+
+	std::sort(rows.begin(), rows.end(), byRetained);
+	printf("%-32s %10s %12s %12s\n", title, "count", "size", "retained");
+	for (size_t i = 0; i < rows.size(); i++)
+		printf("%-32s %10lu %12lu %12lu\n", rows[i].first.c_str(),
+		    (unsigned long)rows[i].second.m_count,
+		    (unsigned long)rows[i].second.m_size,
+		    (unsigned long)rows[i].second.m_retained);
+	printf("\n");
+}
+
+struct ByRetained {
+	const Snapshot &m_snap;
+
+	ByRetained(const Snapshot &snap) : m_snap(snap) {}
+
+	bool
+	operator()(size_t a, size_t b) const
+	{
+		return m_snap.m_retained[a] > m_snap.m_retained[b];
+	}
+};
+
+static void
+report(const Snapshot &snap, size_t nTop)
+{
+	std::vector<size_t> top;
+
+	printTable("kind", snap.m_kinds);
+	if (!snap.m_bySite.empty())
+		printTable("site (sampled objects)", snap.m_bySite);
+	printf("unreachable: %lu objects, %lu bytes\n\n",
+	    (unsigned long)snap.m_unreachable.m_count,
+	    (unsigned long)snap.m_unreachable.m_size);
+
+	for (size_t i = 1; i < snap.m_nodes.size(); i++)
+		if (snap.m_post[i] != kNone)
+			top.push_back(i);
+	if (top.size() > nTop) {
+		std::partial_sort(top.begin(), top.begin() + nTop, top.end(),
+		    ByRetained(snap));
+		top.resize(nTop);
+	} else
+		std::sort(top.begin(), top.end(), ByRetained(snap));
+
+	printf("%-18s %-20s %10s %12s  %s\n", "object", "kind", "size",
+	    "retained", "site");
+	for (size_t i = 0; i < top.size(); i++) {
+		const Node &node = snap.m_nodes[top[i]];
+
+		printf("%-18lx %-20s %10lu %12lu  %s\n",
+		    (unsigned long)node.m_addr, node.m_kind.c_str(),
+		    (unsigned long)node.m_size,
+		    (unsigned long)snap.m_retained[top[i]],
+		    node.m_site ? snap.siteName(node.m_site).c_str() : "-");
+	}
+}
+
+struct Delta {
+	std::string m_name;
+	long m_count;
+	long m_size;
+};
+
+static bool
+bySizeDelta(const Delta &a, const Delta &b)
+{
+	return a.m_size > b.m_size;
+}
+
+static void
+printDiff(const char *title, const std::map<std::string, Totals> &before,
+    const std::map<std::string, Totals> &after)
+{
+	std::map<std::string, Totals> all(before);
+	std::vector<Delta> rows;
+
+	all.insert(after.begin(), after.end());
+	for (std::map<std::string, Totals>::iterator it = all.begin();
+	     it != all.end(); ++it) {
+		std::map<std::string, Totals>::const_iterator a =
+		    before.find(it->first), b = after.find(it->first);
+		Delta delta;
+
+		delta.m_name = it->first;
+		delta.m_count = (b == after.end() ? 0 : b->second.m_count) -
+		    (long)(a == before.end() ? 0 : a->second.m_count);
+		delta.m_size = (b == after.end() ? 0 : b->second.m_size) -
+		    (long)(a == before.end() ? 0 : a->second.m_size);
+		if (delta.m_count || delta.m_size)
+			rows.push_back(delta);
+	}
+
+	std::sort(rows.begin(), rows.end(), bySizeDelta);
+	printf("%-32s %10s %12s\n", title, "+count", "+size");
+	for (size_t i = 0; i < rows.size(); i++)
+		printf("%-32s %+10ld %+12ld\n", rows[i].m_name.c_str(),
+		    rows[i].m_count, rows[i].m_size);
+	printf("\n");
+}
+
+static void
+usage()
+{
+	fprintf(stderr, "usage: xwsheap [-n top] snapshot [later-snapshot]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t nTop = 20;
+	Snapshot snaps[2];
+	int i = 1, nSnaps;
+
+	if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+		nTop = strtoul(argv[i + 1], NULL, 10);
+		i += 2;
+	}
+	nSnaps = argc - i;
+	if (nSnaps < 1 || nSnaps > 2)
+		usage();
+
+	for (int j = 0; j < nSnaps; j++) {
+		if (!snaps[j].read(argv[i + j]))
+			return 1;
+		snaps[j].analyse();
+	}
+
+	if (nSnaps == 1)
+		report(snaps[0], nTop);
+	else {
+		printDiff("kind", snaps[0].m_kinds, snaps[1].m_kinds);
+		printDiff("site (sampled objects)", snaps[0].m_bySite,
+		    snaps[1].m_bySite);
+	}
+
+	return 0;
+}
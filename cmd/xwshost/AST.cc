@@ -44,6 +44,18 @@ NumberNode::accept(Visitor &visitor)
 	return visitor.visitNumber(this, m_value);
 }
 
+int
+Visitor::visitString(StringNode *node, const char *val)
+{
+	return 0;
+}
+
+int
+StringNode::accept(Visitor &visitor)
+{
+	return visitor.visitString(this, m_value);
+}
+
 int
 Visitor::visitFunCall(FunCallNode *node, ExprNode *expr, ExprNode::Vec *args)
 {
@@ -61,7 +73,8 @@ FunCallNode::accept(Visitor &visitor)
 
 int
 Visitor::visitFunExpr(FunctionExprNode *node, const char *name,
-    std::vector<DestructuringNode *> *formals, std::vector<StmtNode *> *body)
+    std::vector<DestructuringNode *> *formals, std::vector<StmtNode *> *body,
+    FunctionExprNode::Kind kind)
 {
 	FOR_EACH (StmtNode::Vec, it, *body)
 		(*it)->accept(*this);
@@ -72,7 +85,35 @@ Visitor::visitFunExpr(FunctionExprNode *node, const char *name,
 int
 FunctionExprNode::accept(Visitor &visitor)
 {
-	return visitor.visitFunExpr(this, m_name.c_str(), m_formals, m_body);
+	return visitor.visitFunExpr(this, m_name.c_str(), m_formals, m_body,
+	    m_kind);
+}
+
+int
+Visitor::visitYield(YieldNode *node, ExprNode *expr)
+{
+	if (expr)
+		expr->accept(*this);
+	return 0;
+}
+
+int
+YieldNode::accept(Visitor &visitor)
+{
+	return visitor.visitYield(this, m_expr);
+}
+
+int
+Visitor::visitAwait(AwaitNode *node, ExprNode *expr)
+{
+	expr->accept(*this);
+	return 0;
+}
+
+int
+AwaitNode::accept(Visitor &visitor)
+{
+	return visitor.visitAwait(this, m_expr);
 }
 
 int
@@ -106,6 +147,22 @@ ExprStmtNode::accept(Visitor &visitor)
 	return visitor.visitExprStmt(this, m_expr);
 }
 
+/** Blocks */
+int
+Visitor::visitBlock(BlockNode *node, StmtNode::Vec *stmts)
+{
+	if (stmts)
+		FOR_EACH (StmtNode::Vec, it, *stmts)
+			(*it)->accept(*this);
+	return 0;
+}
+
+int
+BlockNode::accept(Visitor &visitor)
+{
+	return visitor.visitBlock(this, m_stmts);
+}
+
 /** If statements */
 int
 Visitor::visitIf(IfNode *node, ExprNode *cond, StmtNode *ifCode,
@@ -124,6 +181,71 @@ IfNode::accept(Visitor &visitor)
 	return visitor.visitIf(this, m_cond, m_if, m_else);
 }
 
+/** Iteration statements */
+int
+Visitor::visitDoWhile(DoWhileNode *node, ExprNode *cond, StmtNode *body)
+{
+	body->accept(*this);
+	cond->accept(*this);
+	return 0;
+}
+
+int
+DoWhileNode::accept(Visitor &visitor)
+{
+	return visitor.visitDoWhile(this, m_cond, m_do);
+}
+
+int
+Visitor::visitWhile(WhileNode *node, ExprNode *cond, StmtNode *body)
+{
+	cond->accept(*this);
+	body->accept(*this);
+	return 0;
+}
+
+int
+WhileNode::accept(Visitor &visitor)
+{
+	return visitor.visitWhile(this, m_cond, m_do);
+}
+
+int
+Visitor::visitFor(ForNode *node, StmtNode *init, ExprNode *cond,
+    ExprNode *post, StmtNode *body)
+{
+	if (init)
+		init->accept(*this);
+	if (cond)
+		cond->accept(*this);
+	if (post)
+		post->accept(*this);
+	body->accept(*this);
+	return 0;
+}
+
+int
+ForNode::accept(Visitor &visitor)
+{
+	return visitor.visitFor(this, m_init, m_cond, m_post, m_do);
+}
+
+int
+Visitor::visitForOf(ForOfNode *node, DestructuringNode *binding,
+    ExprNode *expr, StmtNode *body)
+{
+	binding->accept(*this);
+	expr->accept(*this);
+	body->accept(*this);
+	return 0;
+}
+
+int
+ForOfNode::accept(Visitor &visitor)
+{
+	return visitor.visitForOf(this, m_binding, m_expr, m_do);
+}
+
 /** Labelled statements */
 int
 Visitor::visitLabel(LabelNode *node, IdentifierNode *label, StmtNode *stmt)
@@ -162,6 +284,41 @@ BreakNode::accept(Visitor &visitor)
 	return visitor.visitBreak(this, m_label);
 }
 
+/** Exceptions */
+int
+Visitor::visitThrow(ThrowNode *node, ExprNode *expr)
+{
+	expr->accept(*this);
+	return 0;
+}
+
+int
+ThrowNode::accept(Visitor &visitor)
+{
+	return visitor.visitThrow(this, m_expr);
+}
+
+int
+Visitor::visitTry(TryNode *node, StmtNode *tryStmt,
+    DestructuringNode *catchParam, StmtNode *catchStmt, StmtNode *finally)
+{
+	tryStmt->accept(*this);
+	if (catchParam)
+		catchParam->accept(*this);
+	if (catchStmt)
+		catchStmt->accept(*this);
+	if (finally)
+		finally->accept(*this);
+	return 0;
+}
+
+int
+TryNode::accept(Visitor &visitor)
+{
+	return visitor.visitTry(this, m_try, m_catchDestructuring, m_catchStmt,
+	    m_finally);
+}
+
 /** Return Statements */
 int
 ReturnNode::accept(Visitor &visitor)
@@ -216,7 +373,8 @@ Visitor::visitSingleNameDestructuring(SingleNameDestructuringNode *node,
     IdentifierNode *ident, ExprNode *initialiser)
 {
 	ident->accept(*this);
-	initialiser->accept(*this);
+	if (initialiser)
+		initialiser->accept(*this);
 	return 0;
 }
 
@@ -305,7 +463,7 @@ CoverParenthesisedExprAndArrowParameterListNode::toDestructuringVec()
 
 	if ((comma = dynamic_cast<CommaNode *>(m_expr))) {
 		vec = comma->toDestructuringVec(vec);
-	} else {
+	} else if (m_expr) {
 		DestructuringNode *node = m_expr->toDestructuringNode();
 		vec->push_back(node);
 	}
@@ -27,6 +27,8 @@ class AssignNode;
 class ConditionalNode;
 class CommaNode;
 class SpreadNode;
+class YieldNode;
+class AwaitNode;
 
 class StmtNode;
 class BlockNode;
@@ -43,6 +45,7 @@ class ReturnNode;
 class WithNode;
 class LabelNode;
 class ThrowNode;
+class TryNode;
 
 class SingleNameDestructuringNode;
 
@@ -113,12 +116,20 @@ class DeclEnv {
 	friend class BytecodeGenerator;
 	DeclEnv * m_parent;
 	std::map<std::string, Decl *> m_decls;
+	/**
+	 * Whether the function resolves a name bound in an enclosing one (or
+	 * the script), and so needs its environment; as found in generating
+	 * it. A function which does not is given one closure for good.
+	 */
+	bool m_captures;
 
     public:
 	enum Type { kGlobal, kFunction, kBlock } m_type;
 
 	DeclEnv(Type type)
-	    : m_type(type) {};
+	    : m_parent(NULL)
+	    , m_captures(false)
+	    , m_type(type) {};
 
 	void defineArg(const char *name, unsigned int idx);
 	/** define a lexically scoped variable */
@@ -298,7 +309,7 @@ class StringNode : public ExprNode {
 	    : ExprNode(loc)
 	    , m_value(value) {};
 
-	int accept(Visitor &visitor) { throw "unimplemented"; }
+	int accept(Visitor &visitor);
 };
 
 class ArrayNode : public ExprNode {
@@ -352,26 +363,36 @@ class FunCallNode : public ExprNode {
 	    : ExprNode(
 		  args ? loc_from(fun->loc(), args->back()->loc()) : fun->loc())
 	    , m_fun(fun)
-	    , m_args(args) {};
+	    , m_args(args ? args : new std::vector<ExprNode *>) {};
 
 	int accept(Visitor &visitor);
 };
 
 class FunctionExprNode : public ExprNode, public DeclEnv {
+    public:
+	enum Kind {
+		kPlain,
+		kGenerator, /* function * */
+		kAsync,	    /* async function, async arrow function */
+	};
+
     protected:
 	std::string m_name;
 	std::vector<DestructuringNode *> *m_formals;
 	std::vector<StmtNode *> *m_body;
+	Kind m_kind;
 
     public:
 	FunctionExprNode(JSLTYPE loc, char *name,
 	    std::vector<DestructuringNode *> *formals,
-	    std::vector<StmtNode *> *body)
+	    std::vector<StmtNode *> *body, Kind kind = kPlain)
 	    : ExprNode(loc)
 	    , DeclEnv(DeclEnv::kFunction)
 	    , m_name(name == NULL ? "" : name)
-	    , m_formals(formals)
-	    , m_body(body) {};
+	    , m_formals(formals ? formals :
+				  new std::vector<DestructuringNode *>)
+	    , m_body(body ? body : new std::vector<StmtNode *>)
+	    , m_kind(kind) {};
 
 	int accept(Visitor &visitor);
 };
@@ -466,12 +487,36 @@ class SpreadNode : public ExprNode {
 	int accept(Visitor &visitor) { throw "unimplemented"; }
 };
 
+class YieldNode : public ExprNode {
+    protected:
+	ExprNode *m_expr; /* may be NULL */
+
+    public:
+	YieldNode(JSLTYPE loc, ExprNode *expr)
+	    : ExprNode(loc)
+	    , m_expr(expr) {};
+
+	int accept(Visitor &visitor);
+};
+
+class AwaitNode : public ExprNode {
+    protected:
+	ExprNode *m_expr;
+
+    public:
+	AwaitNode(JSLTYPE loc, ExprNode *expr)
+	    : ExprNode(loc)
+	    , m_expr(expr) {};
+
+	int accept(Visitor &visitor);
+};
+
 class BlockNode : public ScopeNode {
     public:
 	BlockNode(JSLTYPE loc, StmtNode::Vec *stmts)
 	    : ScopeNode(loc, DeclEnv::kBlock, stmts) {};
 
-	int accept(Visitor &visitor) { throw "unimplemented"; }
+	int accept(Visitor &visitor);
 };
 
 class ExprStmtNode : public StmtNode {
@@ -513,7 +558,7 @@ class DoWhileNode : public StmtNode {
 	    , m_cond(cond)
 	    , m_do(doBlock) {};
 
-	int accept(Visitor &visitor) { throw "unimplemented"; }
+	int accept(Visitor &visitor);
 };
 
 class WhileNode : public StmtNode {
@@ -527,28 +572,45 @@ class WhileNode : public StmtNode {
 	    , m_cond(cond)
 	    , m_do(doBlock) {};
 
-	int accept(Visitor &visitor) { throw "unimplemented"; }
+	int accept(Visitor &visitor);
 };
 
 class ForNode : public StmtNode {
     protected:
-	StmtNode *m_init;
+	StmtNode *m_init; /* all three may be NULL */
 	ExprNode *m_cond, *m_post;
+	StmtNode *m_do;
 
     public:
-	ForNode(JSLTYPE loc, StmtNode *init, ExprNode *cond, ExprNode *post)
+	ForNode(JSLTYPE loc, StmtNode *init, ExprNode *cond, ExprNode *post,
+	    StmtNode *doBlock)
 	    : StmtNode(loc)
 	    , m_init(init)
 	    , m_cond(cond)
-	    , m_post(post) {};
+	    , m_post(post)
+	    , m_do(doBlock) {};
 
-	int accept(Visitor &visitor) { throw "unimplemented"; }
+	int accept(Visitor &visitor);
 };
 
 class ForInNode : public StmtNode {
 };
 
 class ForOfNode : public StmtNode {
+    protected:
+	DestructuringNode *m_binding;
+	ExprNode *m_expr;
+	StmtNode *m_do;
+
+    public:
+	ForOfNode(JSLTYPE loc, DestructuringNode *binding, ExprNode *expr,
+	    StmtNode *doBlock)
+	    : StmtNode(loc)
+	    , m_binding(binding)
+	    , m_expr(expr)
+	    , m_do(doBlock) {};
+
+	int accept(Visitor &visitor);
 };
 
 class ContinueNode : public StmtNode {
@@ -617,11 +679,25 @@ class LabelNode : public StmtNode {
 
 class ThrowNode : public StmtNode {
     protected:
+	ExprNode *m_expr;
+
+    public:
+	ThrowNode(JSLTYPE loc, ExprNode *expr)
+	    : StmtNode(loc)
+	    , m_expr(expr) {};
+
+	int accept(Visitor &visitor);
+};
+
+class TryNode : public StmtNode {
+    protected:
+	/* at least one of m_catchStmt and m_finally is non-NULL */
 	StmtNode *m_try, *m_catchStmt, *m_finally;
+	/* may be NULL even if there is a catch */
 	DestructuringNode *m_catchDestructuring;
 
     public:
-	ThrowNode(JSLTYPE loc, StmtNode *tryStmt,
+	TryNode(JSLTYPE loc, StmtNode *tryStmt,
 	    DestructuringNode *catchDestructuring, StmtNode *catchStmt,
 	    StmtNode *finally)
 	    : StmtNode(loc)
@@ -630,7 +706,7 @@ class ThrowNode : public StmtNode {
 	    , m_catchStmt(catchStmt)
 	    , m_finally(finally) {};
 
-	int accept(Visitor &visitor) { throw "unimplemented"; }
+	int accept(Visitor &visitor);
 };
 
 /*
@@ -693,7 +769,7 @@ class Visitor {
 	int visitNull(NullNode *node);
 	int visitBool(BoolNode *node);
 	virtual int visitNumber(NumberNode *node, double val);
-	int visitString(StringNode *node);
+	virtual int visitString(StringNode *node, const char *val);
 	int visitArray(ArrayNode *node);
 	int visitObject(ObjectNode *node);
 	int visitAccessor(AccessorNode *node);
@@ -703,7 +779,7 @@ class Visitor {
 	    ExprNode::Vec *args);
 	virtual int visitFunExpr(FunctionExprNode *node, const char *name,
 	    std::vector<DestructuringNode *> *formals,
-	    std::vector<StmtNode *> *body);
+	    std::vector<StmtNode *> *body, FunctionExprNode::Kind kind);
 	int visitUnaryOp(UnaryOpNode *node);
 	virtual int visitBinOp(BinOpNode *node, ExprNode *lhs, BinOp::Op op,
 	    ExprNode *rhs);
@@ -711,23 +787,31 @@ class Visitor {
 	int visitConditional(ConditionalNode *node);
 	int visitComma(CommaNode *node);
 	int visitSpread(SpreadNode *node);
+	virtual int visitYield(YieldNode *node, ExprNode *expr);
+	virtual int visitAwait(AwaitNode *node, ExprNode *expr);
 
-	int visitBlock(BlockNode *node);
+	virtual int visitBlock(BlockNode *node, StmtNode::Vec *stmts);
 	virtual int visitExprStmt(ExprStmtNode *node, ExprNode *expr);
 	virtual int visitIf(IfNode *node, ExprNode *cond, StmtNode *ifCode,
 	    StmtNode *elseCode);
-	int visitDoWhile(DoWhileNode *node);
-	int visitWhile(WhileNode *node);
-	int visitFor(ForNode *node);
+	virtual int visitDoWhile(DoWhileNode *node, ExprNode *cond,
+	    StmtNode *body);
+	virtual int visitWhile(WhileNode *node, ExprNode *cond, StmtNode *body);
+	virtual int visitFor(ForNode *node, StmtNode *init, ExprNode *cond,
+	    ExprNode *post, StmtNode *body);
 	int visitForIn(ForInNode *node);
-	int visitForOf(ForOfNode *node);
+	virtual int visitForOf(ForOfNode *node, DestructuringNode *binding,
+	    ExprNode *expr, StmtNode *body);
 	virtual int visitContinue(ContinueNode *node, IdentifierNode *label);
 	virtual int visitBreak(BreakNode *node, IdentifierNode *label);
 	virtual int visitReturn(ReturnNode *node, ExprNode * expr);
 	int visitWith(WithNode *node);
 	virtual int visitLabel(LabelNode *node, IdentifierNode *label,
 	    StmtNode *stmt);
-	int visitThrow(ThrowNode *node);
+	virtual int visitThrow(ThrowNode *node, ExprNode *expr);
+	virtual int visitTry(TryNode *node, StmtNode *tryStmt,
+	    DestructuringNode *catchParam, StmtNode *catchStmt,
+	    StmtNode *finally);
 
 	virtual int
 	visitSingleNameDestructuring(SingleNameDestructuringNode *node,
@@ -1,5 +1,6 @@
 #include <cstdio>
 #include <cstdlib>
+#include <limits>
 
 #include "Bytecode.hh"
 #include "VM.hh"
@@ -8,13 +9,13 @@ void
 Function::disassemble()
 {
 	int pc = 0;
-	int end = m_bytecode->m_nElements;
+	int end = m_length;
 
 	printf("FUNCTION OF LENGTH %d\n", end);
 	printf("DISASSEMBLY:\n");
 
 	while (pc < end) {
-#define FETCH m_bytecode->m_elements[pc++];
+#define FETCH bytecode()[pc++];
 		char op = FETCH;
 
 		printf(" %d\t", pc - 1);
@@ -78,6 +79,22 @@ Function::disassemble()
 			break;
 		}
 
+		case VM::kLoop: {
+			uint8_t b1 = FETCH;
+			uint8_t b2 = FETCH;
+			int16_t offs = (b1 << 8) | b2;
+			printf("Loop (%d)\n", pc + offs);
+			break;
+		}
+
+		case VM::kLoopIfTrue: {
+			uint8_t b1 = FETCH;
+			uint8_t b2 = FETCH;
+			int16_t offs = (b1 << 8) | b2;
+			printf("LoopIfTrue (%d)\n", pc + offs);
+			break;
+		}
+
 		case VM::kCall: {
 			uint8_t nargs = FETCH;
 			printf("Call (%d)\n", nargs);
@@ -89,20 +106,66 @@ Function::disassemble()
 			break;
 		}
 
+		case VM::kPushStaticClosure: {
+			uint8_t idx = FETCH;
+			printf("PushStaticClosure (%d)\n", idx);
+			break;
+		}
+
 		case VM::kReturn:
 			printf("Return\n");
 			break;
+
+		case VM::kThrow:
+			printf("Throw\n");
+			break;
+
+		case VM::kYield:
+			printf("Yield\n");
+			break;
+
+		case VM::kAwait:
+			printf("Await\n");
+			break;
+
+		case VM::kIterate:
+			printf("Iterate\n");
+			break;
 		}
 	}
+
+	if (m_handlers->m_length > 0)
+		printf("HANDLERS:\n");
+	for (uint32_t i = 0; i < m_handlers->m_length; i += 4)
+		printf(" [%d, %d) -> %d (depth %d)\n",
+		    m_handlers->m_elements[i].get().asI32(),
+		    m_handlers->m_elements[i + 1].get().asI32(),
+		    m_handlers->m_elements[i + 2].get().asI32(),
+		    m_handlers->m_elements[i + 3].get().asI32());
 }
 
 namespace VM {
 
+/*
+ * There is no longer form of jump, so a function which would need one cannot
+ * be compiled.
+ */
+static int16_t
+jumpOffset(ptrdiff_t offset)
+{
+	if (offset < std::numeric_limits<int16_t>::min() ||
+	    offset > std::numeric_limits<int16_t>::max()) {
+		printf("Error: jump of %ld bytes is too long\n", (long)offset);
+		throw "error";
+	}
+	return offset;
+}
+
 void
 BytecodeEncoder::emit0(Op op)
 {
 	m_bytecode.push_back(op);
-	printf("\t%s;\n", opName(op));
+	xwsDbg("\t%s;\n", opName(op));
 }
 
 void
@@ -117,7 +180,7 @@ BytecodeEncoder::emit1i16(Op op, int16_t arg1)
 	m_bytecode.push_back(bytes[0]);
 	m_bytecode.push_back(bytes[1]);
 
-	printf("\t%s (%d);\n", opName(op), arg1);
+	xwsDbg("\t%s (%d);\n", opName(op), arg1);
 }
 
 void
@@ -125,7 +188,7 @@ BytecodeEncoder::emit1(Op op, char arg1)
 {
 	m_bytecode.push_back(op);
 	m_bytecode.push_back(arg1);
-	printf("\t%s (%d);\n", opName(op), arg1);
+	xwsDbg("\t%s (%d);\n", opName(op), arg1);
 }
 
 void
@@ -134,20 +197,45 @@ BytecodeEncoder::emit2(Op op, char arg1, char arg2)
 	m_bytecode.push_back(op);
 	m_bytecode.push_back(arg1);
 	m_bytecode.push_back(arg2);
-	printf("\t%s (%d,%d);\n", opName(op), arg1, arg2);
+	xwsDbg("\t%s (%d,%d);\n", opName(op), arg1, arg2);
+}
+
+void
+BytecodeEncoder::emitBackJump(Op op, size_t target)
+{
+	/* offset is relative to the end of the 3-byte instruction */
+	emit1i16(op, jumpOffset((ptrdiff_t)target - (ptrdiff_t)(pos() + 3)));
+}
+
+BytecodeEncoder::BytecodeEncoder(ObjectMemoryOSThread &omemt)
+    : m_omemt(omemt)
+{
+	mps_root_create(&m_mpsLiteralsRoot, omemt.omem().arena(),
+	    mps_rank_exact(), 0, scanOopVec, &m_literals, 0);
+}
+
+BytecodeEncoder::~BytecodeEncoder()
+{
+	mps_root_destroy(m_mpsLiteralsRoot);
 }
 
 char
 BytecodeEncoder::litNum(double num)
 {
-	m_literals.push_back(m_omemt.makeDouble(num));
+	CodeScope code(m_omemt);
+	PrimOop lit = m_omemt.makeDouble(num);
+
+	m_literals.push_back(lit);
 	return m_literals.size() - 1;
 }
 
 char
 BytecodeEncoder::litStr(const char *txt)
 {
-	m_literals.push_back(m_omemt.makeString(txt));
+	CodeScope code(m_omemt);
+	PrimOop lit = m_omemt.makeString(txt);
+
+	m_literals.push_back(lit);
 	return m_literals.size() - 1;
 }
 
@@ -162,9 +250,9 @@ void
 BytecodeEncoder::replaceJumpTarget(size_t pos, size_t newTarget)
 {
 	uint8_t bytes[2];
-	int16_t relative = newTarget - pos;
+	int16_t relative = jumpOffset((ptrdiff_t)newTarget - (ptrdiff_t)pos);
 
-	printf("AMEND TARGET TO %d\n", relative);
+	xwsDbg("AMEND TARGET TO %d\n", relative);
 	bytes[0] = ((relative & 0xff00) >> 8);
 	bytes[1] = (relative & 0x00FF);
 
@@ -172,6 +260,16 @@ BytecodeEncoder::replaceJumpTarget(size_t pos, size_t newTarget)
 	m_bytecode[pos - 2] = bytes[0];
 }
 
+void
+BytecodeEncoder::addHandler(size_t start, size_t end, size_t handler,
+    size_t depth)
+{
+	m_handlers.push_back(start);
+	m_handlers.push_back(end);
+	m_handlers.push_back(handler);
+	m_handlers.push_back(depth);
+}
+
 size_t
 BytecodeEncoder::pos()
 {
@@ -209,15 +307,36 @@ opName(Op op)
 	case kJumpIfFalse:
 		return "JumpIfFalse";
 
+	case kLoop:
+		return "Loop";
+
+	case kLoopIfTrue:
+		return "LoopIfTrue";
+
 	case kCall:
 		return "Call";
 
 	case kCreateClosure:
 		return "CreateClosure";
 
+	case kPushStaticClosure:
+		return "PushStaticClosure";
+
 	case kReturn:
 		return "Return";
 
+	case kThrow:
+		return "Throw";
+
+	case kYield:
+		return "Yield";
+
+	case kAwait:
+		return "Await";
+
+	case kIterate:
+		return "Iterate";
+
 	default:
 		abort();
 	}
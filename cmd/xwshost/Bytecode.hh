@@ -50,36 +50,74 @@ enum Op {
 
 	kJump,    /* u16 pc-offset */
 	kJumpIfFalse, /* u16 pc-offset */
+	/**
+	 * Loop back edges. These are the only backwards jumps, and the only
+	 * place within a function body that the interpreter polls.
+	 */
+	kLoop,	     /* u16 pc-offset */
+	kLoopIfTrue, /* u16 pc-offset */
 
 	kCall, /* u8 numArgs */
 	kCreateClosure,
+	/**
+	 * Push the closure of a function which captures nothing, made on
+	 * first use from the Function literal, which it then replaces.
+	 */
+	kPushStaticClosure, /* (u8 lit num) */
 	kReturn,
+	kThrow,
+
+	/*
+	 * Generators and async functions. These run in a frame whose first
+	 * operand slot holds their Activation.
+	 */
+	kYield,	  /* suspend, handing the resumer the value on top of stack */
+	kAwait,	  /* suspend until the value on top of stack is settled */
+	kIterate, /* resume the generator on top of stack; push value, more */
 };
 
 class BytecodeEncoder {
 	ObjectMemoryOSThread & m_omemt;
 	std::vector<char> m_bytecode;
 	std::vector<Oop> m_literals;
+	mps_root_t m_mpsLiteralsRoot;
+	/** Handler table entries; see Function::m_handlers. */
+	std::vector<size_t> m_handlers;
 
     public:
-	BytecodeEncoder(ObjectMemoryOSThread & omemt)
-	    : m_omemt(omemt) {};
+	BytecodeEncoder(ObjectMemoryOSThread & omemt);
+	~BytecodeEncoder();
 
 
-	MemOop<Function> makeFun(std::vector<char*> &localNames,
-	std::vector<char*> & paramNames);
+	MemOop<Function> makeFun(Function::Type type,
+	    std::vector<char*> &localNames, std::vector<char*> & paramNames);
 
 	void emit0(Op op);
 	void emit1i16(Op op, int16_t arg1);
 	void emit1(Op op, char arg1);
 	void emit2(Op op, char arg1, char arg2);
+	/**
+	 * Emit a jump op targeting \p target, which has already been emitted.
+	 * Like replaceJumpTarget(), fails compilation if it is beyond a jump's
+	 * reach.
+	 */
+	void emitBackJump(Op op, size_t target);
 
 	char litNum(double num);
 	char litStr(const char * txt);
 	char litObj(Oop obj);
 
+	/** Retarget the jump ending at \p pos to \p newTarget. */
 	void replaceJumpTarget(size_t pos, size_t newTarget);
 
+	/**
+	 * Add an exception handler for [\p start, \p end) at \p handler,
+	 * with \p depth extra operand stack slots live. Handlers must be added
+	 * innermost first.
+	 */
+	void addHandler(size_t start, size_t end, size_t handler,
+	    size_t depth);
+
 	size_t pos();
 };
 
@@ -1,3 +1,4 @@
+#include <cassert>
 #include <cstring>
 #include <stack>
 #include <stdio.h>
@@ -21,7 +22,7 @@ class GenerationContext {
 	GenerationContext(Type type)
 	    : m_type(type)
 	{
-		printf("--> BEGIN %s\n",
+		xwsDbg("--> BEGIN %s\n",
 		    type == kGlobal	  ? "Global" :
 			type == kFunction ? "Function" :
 						  "Block");
@@ -29,7 +30,7 @@ class GenerationContext {
 
 	~GenerationContext()
 	{
-		printf("--> END %s\n",
+		xwsDbg("--> END %s\n",
 		    m_type == kGlobal	    ? "Global" :
 			m_type == kFunction ? "Function" :
 						    "Block");
@@ -44,20 +45,57 @@ class BytecodeGenerator : public Visitor {
 	//std::stack<MemOop<Function> > m_funcs;
 	std::stack<VM::BytecodeEncoder *> m_gens;
 	MemOop<Function> m_script;
+	/** Type of the function being generated. */
+	Function::Type m_funType;
+	/** Scope of the function (or script) being generated. */
+	DeclEnv *m_funEnv;
+
+	/**
+	 * A try statement being generated. The bytecode it protects need not
+	 * be contiguous: code inlined for a finally block on the way out of
+	 * the try (by a break, continue or return) must be excluded, so the
+	 * protected ranges are collected here and turned into handler table
+	 * entries once the statement is complete.
+	 */
+	struct TryDescriptor {
+		StmtNode *m_finally;
+		/** Start of the currently open range. */
+		size_t m_rangeStart;
+		/** Closed ranges of the try block, as [start, end) pairs. */
+		std::vector<size_t> m_tryRanges;
+		/** Closed ranges of the catch block, as [start, end) pairs. */
+		std::vector<size_t> m_catchRanges;
+		/** Is the catch block currently being generated? */
+		bool m_inCatch;
+	};
 
 	struct LabelDescriptor {
+		/** Label name; NULL for an unlabelled iteration statement. */
 		const char *m_ident;
+		/** NULL for a sentinel. */
 		StmtNode *m_stmt;
+		/** For a sentinel, the try statement it stands for, or NULL. */
+		TryDescriptor *m_try;
+		/** Operand stack slots held live while within the statement. */
+		int m_nSlots;
+		/** Is #m_stmt an iteration statement (so may be continued)? */
+		bool m_isIteration;
 		size_t begin;
 		size_t end;
 		/** Jump instructions created by breaks to set offset to end. */
 		std::vector<size_t> m_breaks;
+		/**
+		 * Jump instructions created by continues to set offset to the
+		 * continue point.
+		 */
+		std::vector<size_t> m_continues;
 	};
 
 	/**
-	 * Stack of labels. Later we will also push sentinels to indicate we
-	 * need to pop a block scope; when we reverse iterate over the stack to
-	 * find the label to jump to, we can count those sentinels.
+	 * Stack of labels. Sentinels (with a NULL statement) are also pushed
+	 * for try statements and for values held on the operand stack, so
+	 * that a jump out of them can run the finally blocks and pop the
+	 * values it passes on the way to its target.
 	 */
 	std::vector<LabelDescriptor *> m_labelDescs;
 	/** Labels to be bound to the next statement */
@@ -69,29 +107,66 @@ class BytecodeGenerator : public Visitor {
 	MemOop<Function>exitFunction(DeclEnv *env);
 
 	/** Sets up label stack for a statement. */
-	void enterStmt(StmtNode *stmt, size_t beginPos);
+	void enterStmt(StmtNode *stmt, size_t beginPos,
+	    bool isIteration = false);
+	/** Patch continues targeting an iteration statement to \p pos. */
+	void bindContinues(StmtNode *stmt, size_t pos);
 	void exitStmt(StmtNode *stmt, size_t endPos);
 
+	void pushSentinel(TryDescriptor *tryDesc, int nSlots);
+	void popSentinel();
+	/** Operand stack slots held live at the current point. */
+	int stackDepth();
+	/** End the currently open protected range of \p desc here. */
+	void closeRange(TryDescriptor *desc);
+	/**
+	 * Prepare to leave every statement from m_labelDescs[\p keep] up:
+	 * finally blocks are inlined and, if \p popSlots, held values are
+	 * popped. Try statements left are added to \p left, to be passed to
+	 * reopenRanges() after the jump is emitted.
+	 */
+	void emitExits(size_t keep, bool popSlots,
+	    std::vector<TryDescriptor *> &left);
+	void reopenRanges(std::vector<TryDescriptor *> &left);
+
 	void emitSingleNameDestructuring(const char *txt,
 	    ExprNode *ifUndefined);
+	/**
+	 * Note that the function being generated resolves \p ident, marking
+	 * it and any functions between it and the binding as capturing.
+	 */
+	void noteResolve(const char *ident);
 
 	int visitIdentifier(IdentifierNode *node, const char *ident);
 	int visitNumber(NumberNode *node, double val);
+	int visitString(StringNode *node, const char *val);
 	int visitFunCall(FunCallNode *node, ExprNode *expr,
 	    ExprNode::Vec *args);
 	int visitFunExpr(FunctionExprNode *node, const char *name,
 	    std::vector<DestructuringNode *> *formals,
-	    std::vector<StmtNode *> *body);
+	    std::vector<StmtNode *> *body, FunctionExprNode::Kind kind);
 	int visitBinOp(BinOpNode *node, ExprNode *lhs, BinOp::Op op,
 	    ExprNode *rhs);
+	int visitYield(YieldNode *node, ExprNode *expr);
+	int visitAwait(AwaitNode *node, ExprNode *expr);
 
 	int visitExprStmt(ExprStmtNode *node, ExprNode *expr);
 	int visitIf(IfNode *node, ExprNode *cond, StmtNode *ifCode,
 	    StmtNode *elseCode);
-	// int visitContinue(BreakNode *node, IdentifierNode *label);
+	int visitDoWhile(DoWhileNode *node, ExprNode *cond, StmtNode *body);
+	int visitWhile(WhileNode *node, ExprNode *cond, StmtNode *body);
+	int visitFor(ForNode *node, StmtNode *init, ExprNode *cond,
+	    ExprNode *post, StmtNode *body);
+	int visitForOf(ForOfNode *node, DestructuringNode *binding,
+	    ExprNode *expr, StmtNode *body);
+	int visitContinue(ContinueNode *node, IdentifierNode *label);
 	int visitBreak(BreakNode *node, IdentifierNode *label);
 	int visitReturn(ReturnNode *node, ExprNode *expr);
 	int visitLabel(LabelNode *node, IdentifierNode *label, StmtNode *stmt);
+	int visitThrow(ThrowNode *node, ExprNode *expr);
+	int visitTry(TryNode *node, StmtNode *tryStmt,
+	    DestructuringNode *catchParam, StmtNode *catchStmt,
+	    StmtNode *finally);
 
 	int visitSingleDecl(SingleDeclNode *node, DestructuringNode *lhs,
 	    ExprNode *rhs);
@@ -136,7 +211,7 @@ class Hoister : public Visitor {
 
 	int visitFunExpr(FunctionExprNode *node, const char *name,
 	    std::vector<DestructuringNode *> *formals,
-	    std::vector<StmtNode *> *body);
+	    std::vector<StmtNode *> *body, FunctionExprNode::Kind kind);
 
 	int visitSingleNameDestructuring(SingleNameDestructuringNode *node,
 	    IdentifierNode *ident, ExprNode *initialiser);
@@ -154,16 +229,22 @@ class Hoister : public Visitor {
 };
 
 MemOop<Function>
-VM::BytecodeEncoder::makeFun(std::vector<char *> &localNames,
-    std::vector<char *> &paramNames)
+VM::BytecodeEncoder::makeFun(Function::Type type,
+    std::vector<char *> &localNames, std::vector<char *> &paramNames)
 {
-	MemOop<CharArray> bytecode = m_omemt.makeCharArray(m_bytecode);
-	MemOop<EnvironmentMap> envMap = m_omemt.makeEnvironmentMap(paramNames,
-	    localNames);
-	MemOop<PlainArray> literals = m_omemt.makeArray(m_literals.size());
-	memcpy(literals->m_elements, m_literals.data(), m_literals.size() * sizeof(Oop));
-
-	return m_omemt.makeFunction(envMap, bytecode, literals);
+	CodeScope code(m_omemt);
+	HandleScope scope(m_omemt);
+	Handle<EnvironmentMap> envMap(m_omemt,
+	    m_omemt.makeEnvironmentMap(paramNames, localNames));
+	Handle<PlainArray> handlers(m_omemt,
+	    m_omemt.makeArray(m_handlers.size()));
+
+	for (size_t i = 0; i < m_handlers.size(); i++)
+		handlers->m_elements[i] = Smi(m_handlers[i]);
+
+	/* m_literals is a root, so they are good across this allocation */
+	return m_omemt.makeFunction(envMap, m_bytecode, m_literals, handlers,
+	    type);
 }
 
 /*
@@ -172,7 +253,8 @@ VM::BytecodeEncoder::makeFun(std::vector<char *> &localNames,
 
 int
 Hoister::visitFunExpr(FunctionExprNode *node, const char *name,
-    std::vector<DestructuringNode *> *formals, std::vector<StmtNode *> *body)
+    std::vector<DestructuringNode *> *formals, std::vector<StmtNode *> *body,
+    FunctionExprNode::Kind kind)
 {
 	node->m_parent = m_envs.top();
 	m_envs.push(node);
@@ -242,6 +324,8 @@ Hoister::visitSingleNameDestructuring(SingleNameDestructuringNode *node,
 
 BytecodeGenerator::BytecodeGenerator(ObjectMemoryOSThread &omemt)
     : m_omemt(omemt)
+    , m_funType(Function::kPlain)
+    , m_funEnv(NULL)
 {
 	m_ctx.push(new GenerationContext(GenerationContext::kGlobal));
 }
@@ -276,7 +360,7 @@ BytecodeGenerator::exitFunction(DeclEnv *env)
 		}
 
 
-	jsf = m_gens.top()->makeFun(localNames, paramNames);
+	jsf = m_gens.top()->makeFun(m_funType, localNames, paramNames);
 	delete m_gens.top();
 	m_gens.pop();
 
@@ -284,33 +368,61 @@ BytecodeGenerator::exitFunction(DeclEnv *env)
 }
 
 void
-BytecodeGenerator::enterStmt(StmtNode *stmt, size_t beginPos)
+BytecodeGenerator::enterStmt(StmtNode *stmt, size_t beginPos,
+    bool isIteration)
 {
-	LabelDescriptor *desc = NULL;
+	LabelDescriptor *desc;
+
+	/*
+	 * An iteration statement always gets a descriptor, so that unlabelled
+	 * break and continue can find it.
+	 */
+	if (isIteration) {
+		desc = new LabelDescriptor;
+		desc->m_stmt = stmt;
+		desc->m_ident = NULL;
+		desc->m_try = NULL;
+		desc->m_nSlots = 0;
+		desc->m_isIteration = true;
+		desc->begin = beginPos;
+		m_labelDescs.push_back(desc);
+	}
 
 	while (!m_nextStmtLabels.empty()) {
 		IdentifierNode *id = m_nextStmtLabels.back();
 
 		m_nextStmtLabels.pop_back();
 
-		if (!desc) {
-			desc = new LabelDescriptor;
-			desc->m_stmt = stmt;
-			desc->m_ident = id->value();
-			desc->begin = beginPos;
-		}
+		desc = new LabelDescriptor;
+		desc->m_stmt = stmt;
+		desc->m_ident = id->value();
+		desc->m_try = NULL;
+		desc->m_nSlots = 0;
+		desc->m_isIteration = isIteration;
+		desc->begin = beginPos;
 
 		m_labelDescs.push_back(desc);
 	}
 }
 
+void
+BytecodeGenerator::bindContinues(StmtNode *stmt, size_t pos)
+{
+	for (std::vector<LabelDescriptor *>::reverse_iterator it =
+		 m_labelDescs.rbegin();
+	     it != m_labelDescs.rend() && (*it)->m_stmt == stmt; it++)
+		for (std::vector<size_t>::iterator it2 =
+			 (*it)->m_continues.begin();
+		     it2 != (*it)->m_continues.end(); it2++)
+			coder()->replaceJumpTarget(*it2, pos);
+}
+
 void
 BytecodeGenerator::exitStmt(StmtNode *stmt, size_t emdPos)
 {
 	while (!m_labelDescs.empty() && m_labelDescs.back()->m_stmt == stmt) {
 		LabelDescriptor *desc = m_labelDescs.back();
 		m_labelDescs.pop_back();
-		printf("May rewrite label <%s>\n", desc->m_ident);
 		for (std::vector<size_t>::iterator it = desc->m_breaks.begin();
 		     it != desc->m_breaks.end(); it++) {
 			/* patch break statements to the end of the statement */
@@ -320,9 +432,116 @@ BytecodeGenerator::exitStmt(StmtNode *stmt, size_t emdPos)
 	}
 }
 
+void
+BytecodeGenerator::pushSentinel(TryDescriptor *tryDesc, int nSlots)
+{
+	LabelDescriptor *desc = new LabelDescriptor;
+
+	desc->m_stmt = NULL;
+	desc->m_ident = NULL;
+	desc->m_try = tryDesc;
+	desc->m_nSlots = nSlots;
+	desc->m_isIteration = false;
+	m_labelDescs.push_back(desc);
+}
+
+void
+BytecodeGenerator::popSentinel()
+{
+	assert(m_labelDescs.back()->m_stmt == NULL);
+	delete m_labelDescs.back();
+	m_labelDescs.pop_back();
+}
+
+int
+BytecodeGenerator::stackDepth()
+{
+	int depth = 0;
+
+	for (std::vector<LabelDescriptor *>::iterator it =
+		 m_labelDescs.begin();
+	     it != m_labelDescs.end(); it++)
+		depth += (*it)->m_nSlots;
+
+	return depth;
+}
+
+void
+BytecodeGenerator::closeRange(TryDescriptor *desc)
+{
+	std::vector<size_t> &ranges = desc->m_inCatch ? desc->m_catchRanges :
+							desc->m_tryRanges;
+
+	if (coder()->pos() == desc->m_rangeStart)
+		return;
+	ranges.push_back(desc->m_rangeStart);
+	ranges.push_back(coder()->pos());
+}
+
+void
+BytecodeGenerator::emitExits(size_t keep, bool popSlots,
+    std::vector<TryDescriptor *> &left)
+{
+	for (size_t i = m_labelDescs.size(); i-- > keep;) {
+		LabelDescriptor *desc = m_labelDescs[i];
+
+		if (popSlots)
+			for (int j = 0; j < desc->m_nSlots; j++)
+				coder()->emit0(VM::kPop);
+
+		if (!desc->m_try)
+			continue;
+
+		closeRange(desc->m_try);
+		left.push_back(desc->m_try);
+
+		/*
+		 * The finally block sees only the statements enclosing its
+		 * try statement, and remains protected by their handlers.
+		 */
+		if (desc->m_try->m_finally) {
+			std::vector<LabelDescriptor *> inner(
+			    m_labelDescs.begin() + i, m_labelDescs.end());
+
+			m_labelDescs.resize(i);
+			desc->m_try->m_finally->accept(*this);
+			m_labelDescs.insert(m_labelDescs.end(), inner.begin(),
+			    inner.end());
+		}
+	}
+}
+
+void
+BytecodeGenerator::reopenRanges(std::vector<TryDescriptor *> &left)
+{
+	for (std::vector<TryDescriptor *>::iterator it = left.begin();
+	     it != left.end(); it++)
+		(*it)->m_rangeStart = coder()->pos();
+}
+
+/*
+ * Names are resolved along the chain of environments at run time, so a
+ * function needs its enclosing environment only for names bound in it: those
+ * of the globals (bound by no scope here) are found from any chain.
+ */
+void
+BytecodeGenerator::noteResolve(const char *ident)
+{
+	DeclEnv *binder = m_funEnv;
+
+	while (binder && !binder->m_decls.count(ident))
+		binder = binder->m_parent;
+	if (!binder)
+		return;
+
+	for (DeclEnv *env = m_funEnv; env != binder; env = env->m_parent)
+		env->m_captures = true;
+}
+
 int
 BytecodeGenerator::visitIdentifier(IdentifierNode *node, const char *ident)
 {
+	noteResolve(ident);
 	m_gens.top()->emit1(VM::kResolve, m_gens.top()->litStr(ident));
 	return 0;
 }
@@ -334,6 +553,13 @@ BytecodeGenerator::visitNumber(NumberNode *node, double val)
 	return 0;
 }
 
+int
+BytecodeGenerator::visitString(StringNode *node, const char *val)
+{
+	m_gens.top()->emit1(VM::kPushLiteral, m_gens.top()->litStr(val));
+	return 0;
+}
+
 int
 BytecodeGenerator::visitFunCall(FunCallNode *node, ExprNode *expr,
     ExprNode::Vec *args)
@@ -348,13 +574,26 @@ BytecodeGenerator::visitFunCall(FunCallNode *node, ExprNode *expr,
 
 int
 BytecodeGenerator::visitFunExpr(FunctionExprNode *node, const char *name,
-    std::vector<DestructuringNode *> *formals, std::vector<StmtNode *> *body)
+    std::vector<DestructuringNode *> *formals, std::vector<StmtNode *> *body,
+    FunctionExprNode::Kind kind)
 {
 	int nParams = 0;
 	MemOop<Function> jsf;
-
+	/* labels are not visible across function boundaries */
+	std::vector<LabelDescriptor *> outerLabelDescs;
+	Function::Type outerFunType = m_funType;
+	DeclEnv *outerFunEnv = m_funEnv;
+
+	outerLabelDescs.swap(m_labelDescs);
+	m_funEnv = node;
+	m_funType = kind == FunctionExprNode::kGenerator ? Function::kGenerator :
+	    kind == FunctionExprNode::kAsync		 ? Function::kAsync :
+							   Function::kPlain;
 	m_ctx.push(new GenerationContext(GenerationContext::kFunction));
 	enterNewFunction();
+	/* the first operand stack slot holds the Activation */
+	if (m_funType != Function::kPlain)
+		pushSentinel(NULL, 1);
 	//jsf = enterNewFunction();
 	//jsf->m_paramNames.resize(formals->size(), NULL);
 
@@ -367,12 +606,22 @@ BytecodeGenerator::visitFunExpr(FunctionExprNode *node, const char *name,
 		(*it)->accept(*this);
 	}
 
+	if (m_funType != Function::kPlain)
+		popSentinel();
 	jsf = exitFunction(node);
 	delete (m_ctx.top());
 	m_ctx.pop();
-
-	m_gens.top()->emit1(VM::kPushLiteral, m_gens.top()->litObj(jsf));
-	m_gens.top()->emit0(VM::kCreateClosure);
+	m_labelDescs.swap(outerLabelDescs);
+	m_funType = outerFunType;
+	m_funEnv = outerFunEnv;
+
+	if (node->m_captures) {
+		m_gens.top()->emit1(VM::kPushLiteral,
+		    m_gens.top()->litObj(jsf));
+		m_gens.top()->emit0(VM::kCreateClosure);
+	} else
+		m_gens.top()->emit1(VM::kPushStaticClosure,
+		    m_gens.top()->litObj(jsf));
 
 	return 0;
 }
@@ -387,6 +636,35 @@ BytecodeGenerator::visitBinOp(BinOpNode *node, ExprNode *lhs, BinOp::Op op,
 	return 0;
 }
 
+int
+BytecodeGenerator::visitYield(YieldNode *node, ExprNode *expr)
+{
+	if (m_funType != Function::kGenerator) {
+		printf("Syntax error: yield outside of generator\n");
+		throw "error";
+	}
+
+	if (expr)
+		expr->accept(*this);
+	else
+		coder()->emit0(VM::kPushUndefined);
+	coder()->emit0(VM::kYield);
+	return 0;
+}
+
+int
+BytecodeGenerator::visitAwait(AwaitNode *node, ExprNode *expr)
+{
+	if (m_funType != Function::kAsync) {
+		printf("Syntax error: await outside of async function\n");
+		throw "error";
+	}
+
+	expr->accept(*this);
+	coder()->emit0(VM::kAwait);
+	return 0;
+}
+
 int
 BytecodeGenerator::visitExprStmt(ExprStmtNode *node, ExprNode *expr)
 {
@@ -436,34 +714,225 @@ BytecodeGenerator::visitIf(IfNode *node, ExprNode *cond, StmtNode *ifCode,
 	return 0;
 }
 
+/*
+ * Loops are compiled inverted, with the test at the bottom, so that each
+ * iteration executes only the body and a single conditional back edge:
+ *
+ *	Jump test
+ * body:
+ *	<body>
+ * continue:
+ *	<post>			(for loops only)
+ * test:
+ *	<cond>
+ *	LoopIfTrue body
+ * end:
+ *
+ * A do-while loop is the same without the initial jump; a loop without a test
+ * ends in an unconditional Loop instead.
+ */
+
 int
-BytecodeGenerator::visitBreak(BreakNode *node, IdentifierNode *label)
+BytecodeGenerator::visitDoWhile(DoWhileNode *node, ExprNode *cond,
+    StmtNode *body)
 {
-	int nScopesToPop = 0;
+	size_t bodyPos;
 
-	for (std::vector<LabelDescriptor *>::reverse_iterator it =
-		 m_labelDescs.rbegin();
-	     it != m_labelDescs.rend(); it++) {
-		if ((*it)->m_stmt == 0) {
-			/* null statement is a block scope sentinel */
-			nScopesToPop++;
-		} else if (!label || !strcmp((*it)->m_ident, label->value())) {
+	enterStmt(node, coder()->pos(), true);
+
+	bodyPos = coder()->pos();
+	body->accept(*this);
+
+	bindContinues(node, coder()->pos());
+	cond->accept(*this);
+	coder()->emitBackJump(VM::kLoopIfTrue, bodyPos);
+
+	exitStmt(node, coder()->pos());
+
+	return 0;
+}
+
+int
+BytecodeGenerator::visitWhile(WhileNode *node, ExprNode *cond, StmtNode *body)
+{
+	size_t jumpToTest, bodyPos;
+
+	enterStmt(node, coder()->pos(), true);
+
+	/* jump to the test; 0 is a placeholder */
+	coder()->emit1i16(VM::kJump, 0);
+	jumpToTest = coder()->pos();
+
+	bodyPos = coder()->pos();
+	body->accept(*this);
+
+	bindContinues(node, coder()->pos());
+	coder()->replaceJumpTarget(jumpToTest, coder()->pos());
+	cond->accept(*this);
+	coder()->emitBackJump(VM::kLoopIfTrue, bodyPos);
+
+	exitStmt(node, coder()->pos());
+
+	return 0;
+}
+
+int
+BytecodeGenerator::visitFor(ForNode *node, StmtNode *init, ExprNode *cond,
+    ExprNode *post, StmtNode *body)
+{
+	size_t jumpToTest, bodyPos;
+
+	if (init)
+		init->accept(*this);
+
+	enterStmt(node, coder()->pos(), true);
+
+	if (cond) {
+		/* jump to the test; 0 is a placeholder */
+		coder()->emit1i16(VM::kJump, 0);
+		jumpToTest = coder()->pos();
+	}
+
+	bodyPos = coder()->pos();
+	body->accept(*this);
+
+	bindContinues(node, coder()->pos());
+	if (post) {
+		post->accept(*this);
+		coder()->emit0(VM::kPop);
+	}
+
+	if (cond) {
+		coder()->replaceJumpTarget(jumpToTest, coder()->pos());
+		cond->accept(*this);
+		coder()->emitBackJump(VM::kLoopIfTrue, bodyPos);
+	} else
+		coder()->emitBackJump(VM::kLoop, bodyPos);
+
+	exitStmt(node, coder()->pos());
+
+	return 0;
+}
+
+/*
+ * The generator is held on the operand stack for the duration of the loop, so
+ * a break leaves through the code which pops it:
+ *
+ *	<expr>
+ * next:
+ *	Iterate
+ *	JumpIfFalse done
+ *	ResolvedStore <binding>
+ *	Pop
+ *	<body>
+ *	Loop next		(continue target)
+ * done:
+ *	Pop			(the generator's return value)
+ * break:
+ *	Pop			(the generator)
+ */
+int
+BytecodeGenerator::visitForOf(ForOfNode *node, DestructuringNode *binding,
+    ExprNode *expr, StmtNode *body)
+{
+	size_t nextPos, jumpToDone;
+	DestructuringVisitor destr(*this);
+
+	expr->accept(*this);
+	pushSentinel(NULL, 1);
+
+	enterStmt(node, coder()->pos(), true);
+
+	nextPos = coder()->pos();
+	coder()->emit0(VM::kIterate);
+	/* leave the loop once the generator is done; 0 is a placeholder */
+	coder()->emit1i16(VM::kJumpIfFalse, 0);
+	jumpToDone = coder()->pos();
+
+	binding->accept(destr);
+	coder()->emit0(VM::kPop);
+	body->accept(*this);
+
+	bindContinues(node, coder()->pos());
+	coder()->emitBackJump(VM::kLoop, nextPos);
+
+	coder()->replaceJumpTarget(jumpToDone, coder()->pos());
+	coder()->emit0(VM::kPop);
+
+	exitStmt(node, coder()->pos());
+	popSentinel();
+	coder()->emit0(VM::kPop);
+
+	return 0;
+}
+
+int
+BytecodeGenerator::visitContinue(ContinueNode *node, IdentifierNode *label)
+{
+	for (size_t i = m_labelDescs.size(); i-- > 0;) {
+		LabelDescriptor *desc = m_labelDescs[i];
 
+		if (desc->m_stmt == 0 || !desc->m_isIteration)
+			continue;
+		else if (!label || (desc->m_ident &&
+		    !strcmp(desc->m_ident, label->value()))) {
+			std::vector<TryDescriptor *> left;
+
+			emitExits(i + 1, true, left);
+			coder()->emit1i16(VM::kJump, 0);
+			desc->m_continues.push_back(coder()->pos());
+			reopenRanges(left);
+			return 0;
+		}
+	}
+
+	if (label)
+		printf("Syntax error: undefined loop label <%s>\n",
+		    label->value());
+	else
+		printf("Syntax error: continue outside of loop\n");
+	throw "error";
+}
+
+int
+BytecodeGenerator::visitBreak(BreakNode *node, IdentifierNode *label)
+{
+	for (size_t i = m_labelDescs.size(); i-- > 0;) {
+		LabelDescriptor *desc = m_labelDescs[i];
+
+		if (desc->m_stmt == 0) {
+			/* null statement is a sentinel */
+			continue;
+		} else if (label ? (desc->m_ident &&
+		    !strcmp(desc->m_ident, label->value())) :
+		    desc->m_isIteration) {
+			std::vector<TryDescriptor *> left;
+
+			emitExits(i + 1, true, left);
 			coder()->emit1i16(VM::kJump, 0);
-			(*it)->m_breaks.push_back(coder()->pos());
+			desc->m_breaks.push_back(coder()->pos());
+			reopenRanges(left);
 			return 0;
 		}
 	}
 
-	printf("Syntax error: undefined label <%s>", label->value());
+	if (label)
+		printf("Syntax error: undefined label <%s>\n", label->value());
+	else
+		printf("Syntax error: break outside of loop\n");
 	throw "error";
 }
 
 int
 BytecodeGenerator::visitReturn(ReturnNode *node, ExprNode *expr)
 {
+	std::vector<TryDescriptor *> left;
+
 	expr->accept(*this);
+	/* Return discards the operand stack itself, so nothing is popped. */
+	emitExits(0, false, left);
 	m_gens.top()->emit0(VM::kReturn);
+	reopenRanges(left);
 	return 0;
 }
 
@@ -476,6 +945,111 @@ BytecodeGenerator::visitLabel(LabelNode *node, IdentifierNode *label,
 	return 0;
 }
 
+int
+BytecodeGenerator::visitThrow(ThrowNode *node, ExprNode *expr)
+{
+	expr->accept(*this);
+	coder()->emit0(VM::kThrow);
+	return 0;
+}
+
+/*
+ * Try statements cost nothing unless an exception is thrown: no instructions
+ * are emitted on entry to or exit from the try block, and the handlers are
+ * instead described by entries in the function's handler table.
+ *
+ *	<try block>		(protected by catch and finally handlers)
+ *	Jump finally
+ * catch:
+ *	ResolvedStore <param>
+ *	Pop
+ *	<catch block>		(protected by finally handler)
+ * finally:
+ *	<finally block>
+ *	Jump end
+ * finallyHandler:
+ *	<finally block>
+ *	Throw
+ * end:
+ *
+ * A break, continue or return leaving the try or catch blocks has the finally
+ * block inlined before it instead.
+ */
+int
+BytecodeGenerator::visitTry(TryNode *node, StmtNode *tryStmt,
+    DestructuringNode *catchParam, StmtNode *catchStmt, StmtNode *finally)
+{
+	TryDescriptor desc;
+	int depth;
+	size_t catchPos, jumpPastCatch, finallyPos, jumpToEnd;
+
+	enterStmt(node, coder()->pos());
+	depth = stackDepth();
+
+	desc.m_finally = finally;
+	desc.m_inCatch = false;
+	desc.m_rangeStart = coder()->pos();
+	pushSentinel(&desc, 0);
+
+	tryStmt->accept(*this);
+	closeRange(&desc);
+
+	if (catchStmt) {
+		/* jump past the catch block; 0 is a placeholder */
+		coder()->emit1i16(VM::kJump, 0);
+		jumpPastCatch = coder()->pos();
+
+		catchPos = coder()->pos();
+		desc.m_inCatch = true;
+		desc.m_rangeStart = coder()->pos();
+		if (catchParam) {
+			DestructuringVisitor destr(*this);
+			catchParam->accept(destr);
+		}
+		coder()->emit0(VM::kPop);
+		catchStmt->accept(*this);
+		closeRange(&desc);
+
+		coder()->replaceJumpTarget(jumpPastCatch, coder()->pos());
+	}
+
+	popSentinel();
+
+	if (finally) {
+		finally->accept(*this);
+		/* jump to the end; 0 is a placeholder */
+		coder()->emit1i16(VM::kJump, 0);
+		jumpToEnd = coder()->pos();
+
+		/* the exception is held on the stack while the block runs */
+		finallyPos = coder()->pos();
+		pushSentinel(NULL, 1);
+		finally->accept(*this);
+		coder()->emit0(VM::kThrow);
+		popSentinel();
+
+		coder()->replaceJumpTarget(jumpToEnd, coder()->pos());
+	}
+
+	if (catchStmt)
+		for (size_t i = 0; i < desc.m_tryRanges.size(); i += 2)
+			coder()->addHandler(desc.m_tryRanges[i],
+			    desc.m_tryRanges[i + 1], catchPos, depth);
+
+	if (finally) {
+		for (size_t i = 0; i < desc.m_tryRanges.size(); i += 2)
+			coder()->addHandler(desc.m_tryRanges[i],
+			    desc.m_tryRanges[i + 1], finallyPos, depth);
+		for (size_t i = 0; i < desc.m_catchRanges.size(); i += 2)
+			coder()->addHandler(desc.m_catchRanges[i],
+			    desc.m_catchRanges[i + 1], finallyPos, depth);
+	}
+
+	exitStmt(node, coder()->pos());
+
+	return 0;
+}
+
 int
 DestructuringVisitor::visitSingleNameDestructuring(
     SingleNameDestructuringNode *node, IdentifierNode *ident,
@@ -497,9 +1071,11 @@ DestructuringVisitor::visitSingleNameDestructuring(
 			printf("/* not undefined */\n");
 		}
 #endif
-		if (kind != kParam)
+		if (kind != kParam) {
+			m_gen.noteResolve(ident->value());
 			m_gen.coder()->emit1(VM::kResolvedStore,
 			    m_gen.coder()->litStr(ident->value()));
+		}
 	} else {
 		printf("UNIMPLEMENTED!\n");
 		throw 0;
@@ -532,12 +1108,15 @@ BytecodeGenerator::visitDecl(DeclNode *node, DeclNode::Type type,
 int
 BytecodeGenerator::visitScript(ScriptNode *node, StmtNode::Vec *stmts)
 {
+	m_funEnv = node;
 	enterNewFunction();
 	for (StmtNode::Vec::iterator it = stmts->begin(); it != stmts->end();
 	     it++)
 		(*it)->accept(*this);
 	m_script = exitFunction(node);
+#ifdef XWS_DEBUG
 	m_script->disassemble();
+#endif
 	return 0;
 }
 
@@ -0,0 +1,777 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "EventLoop.hh"
+#include "VM.hh"
+#include "Object.inl.hh"
+
+#define FATAL(...) errx(EXIT_FAILURE, __VA_ARGS__)
+
+static uint64_t
+monotonicMillis()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* A delay in ms; anything which is not a positive number is 0. */
+static uint64_t
+toMillis(Oop val)
+{
+	if (val.isSmi())
+		return val.asI32() > 0 ? val.asI32() : 0;
+	else if (val.type() == Oop::kDouble && *val.dblAddr() > 0)
+		return (uint64_t)*val.dblAddr();
+	return 0;
+}
+
+bool
+EventLoop::Timer::operator<(const Timer &other) const
+{
+	if (m_when != other.m_when)
+		return m_when > other.m_when;
+	return m_seq > other.m_seq;
+}
+
+EventLoop::EventLoop(ObjectMemoryOSThread &omemt, bool useRing)
+    : m_omemt(omemt)
+    , m_nextSeq(1)
+    , m_nOps(0)
+    , m_cleanedEpoch(omemt.omem().epoch())
+{
+	mps_root_create(&m_mpsRoot, omemt.omem().arena(), mps_rank_exact(),
+	    MPS_RM_PROT, scanOopVec, &m_targets, 0);
+	mps_root_create(&m_mpsOpsRoot, omemt.omem().arena(), mps_rank_exact(),
+	    MPS_RM_PROT, scanOopVec, &m_opOops, 0);
+	mps_root_create(&m_mpsPinnedRoot, omemt.omem().arena(),
+	    mps_rank_ambig(), 0, scanPinnedVec, &m_pinned, 0);
+	mps_root_create(&m_mpsRegistriesRoot, omemt.omem().arena(),
+	    mps_rank_weak(), MPS_RM_PROT, scanWeakOopVec, &m_registries, 0);
+
+	if (useRing)
+		m_ring.init(kRingEntries);
+	m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_wakeFd < 0)
+		FATAL("couldn't create eventfd: %s", strerror(errno));
+}
+
+/*
+ * The kernel may write to the bytes of an operation in flight until it
+ * completes, so those are cancelled and waited for before they are unpinned.
+ * A read of a regular file may not be cancellable once started, but it will
+ * not be long in finishing.
+ */
+EventLoop::~EventLoop()
+{
+	struct io_uring_cqe cqe;
+
+	for (size_t slot = 0; slot < m_ops.size(); slot++)
+		if (m_pinned[slot])
+			m_ring.cancel(slot);
+	while (m_nOps > 0 && m_ring.wait())
+		while (m_ring.reap(cqe))
+			if (cqe.user_data != IOUring::kCancelTag) {
+				close(m_ops[cqe.user_data].m_fd);
+				m_nOps--;
+			}
+
+	mps_root_destroy(m_mpsRegistriesRoot);
+	mps_root_destroy(m_mpsPinnedRoot);
+	mps_root_destroy(m_mpsOpsRoot);
+	mps_root_destroy(m_mpsRoot);
+	close(m_wakeFd);
+}
+
+MemOop<Environment>
+EventLoop::makeGlobals()
+{
+	static const char *names[] = { "setTimeout", "queueMicrotask",
+		"sleep", "readFile", "writeFile", "mapFile", "byteLength", "gcStats",
+		"weakRef", "deref", "weakMap", "weakMapGet", "weakMapSet",
+		"weakMapHas", "weakMapDelete", "finalizationRegistry",
+		"registerFinalizer", "heapSnapshot" };
+	static const NativeFunction::Fn fns[] = { setTimeout, queueMicrotask,
+		sleep, readFile, writeFile, mapFile, byteLength, gcStats,
+		weakRef, deref, weakMap, weakMapGet, weakMapSet, weakMapHas,
+		weakMapDelete, finalizationRegistry, registerFinalizer,
+		heapSnapshot };
+	std::vector<char *> paramNames, localNames;
+	HandleScope scope(m_omemt);
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++)
+		localNames.push_back((char *)names[i]);
+
+	Handle<Environment> env(m_omemt, m_omemt.makeEnvironment(
+	    *(MemOop<Environment> *)&ObjectMemory::s_undefined,
+	    m_omemt.makeEnvironmentMap(paramNames, localNames), 0));
+	for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		MemOop<NativeFunction> fn = m_omemt.makeNativeFunction(fns[i],
+		    this, names[i]);
+
+		env->m_locals->m_elements[i] = fn;
+	}
+
+	return env;
+}
+
+uint64_t
+EventLoop::addTimer(uint64_t delay, Oop target)
+{
+	Timer timer;
+
+	if (m_freeSlots.empty()) {
+		timer.m_slot = m_targets.size();
+		m_targets.push_back(target);
+	} else {
+		timer.m_slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		m_targets[timer.m_slot] = target;
+	}
+	timer.m_when = monotonicMillis() + delay;
+	timer.m_seq = m_nextSeq++;
+
+	m_timers.push_back(timer);
+	std::push_heap(m_timers.begin(), m_timers.end());
+
+	return timer.m_seq;
+}
+
+void
+EventLoop::fire(VM::Interpreter &interp)
+{
+	size_t slot = m_timers.front().m_slot;
+	Oop target = m_targets[slot];
+
+	std::pop_heap(m_timers.begin(), m_timers.end());
+	m_timers.pop_back();
+	m_targets[slot] = ObjectMemory::s_undefined;
+	m_freeSlots.push_back(slot);
+
+	if (target.tag() == Oop::kObject &&
+	    target.addrT<ObjectDesc>()->m_kind == ObjectDesc::kPromise)
+		interp.settle(*(MemOop<Promise> *)&target, Promise::kFulfilled,
+		    ObjectMemory::s_undefined);
+	else
+		interp.enqueueMicrotask(target, ObjectMemory::s_undefined);
+}
+
+void
+EventLoop::startFileOp(VM::Interpreter &interp, int fd, bool write,
+    void *pinned, char *data, size_t len, MemOop<Promise> promise, Oop buffer)
+{
+	size_t slot;
+
+	if (m_freeOps.empty()) {
+		slot = m_ops.size();
+		m_ops.push_back(FileOp());
+		m_opOops.push_back(ObjectMemory::s_undefined);
+		m_opOops.push_back(ObjectMemory::s_undefined);
+		m_pinned.push_back(NULL);
+	} else {
+		slot = m_freeOps.back();
+		m_freeOps.pop_back();
+	}
+
+	m_ops[slot].m_fd = fd;
+	m_ops[slot].m_write = write;
+	m_ops[slot].m_data = data;
+	m_ops[slot].m_len = len;
+	m_ops[slot].m_done = 0;
+	m_opOops[slot * 2] = promise;
+	m_opOops[slot * 2 + 1] = buffer;
+	m_pinned[slot] = pinned;
+	m_nOps++;
+
+	if (len == 0)
+		finishFileOp(interp, slot, 0);
+	else if (!m_ring.ok() || !submitFileOp(slot))
+		runFileOp(interp, slot);
+}
+
+/*
+ * A full submission queue is flushed to make room; if that fails too the
+ * operation is done synchronously instead.
+ */
+bool
+EventLoop::submitFileOp(size_t slot)
+{
+	FileOp &op = m_ops[slot];
+	struct io_uring_sqe *sqe = m_ring.getSqe();
+	size_t len = op.m_len - op.m_done;
+
+	if (!sqe && m_ring.submit())
+		sqe = m_ring.getSqe();
+	if (!sqe)
+		return false;
+
+	sqe->opcode = op.m_write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = op.m_fd;
+	sqe->addr = (uintptr_t)(op.m_data + op.m_done);
+	sqe->len = len > kMaxTransfer ? kMaxTransfer : len;
+	sqe->off = op.m_done;
+	sqe->user_data = slot;
+
+	return true;
+}
+
+void
+EventLoop::runFileOp(VM::Interpreter &interp, size_t slot)
+{
+	for (;;) {
+		FileOp &op = m_ops[slot];
+		size_t len = op.m_len - op.m_done;
+		ssize_t res;
+
+		if (len > kMaxTransfer)
+			len = kMaxTransfer;
+		if (op.m_write)
+			res = pwrite(op.m_fd, op.m_data + op.m_done, len,
+			    op.m_done);
+		else
+			res = pread(op.m_fd, op.m_data + op.m_done, len,
+			    op.m_done);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (advanceFileOp(interp, slot, res < 0 ? -errno : res))
+			return;
+	}
+}
+
+/*
+ * A read which reaches end of file early, as when the file shrank after its
+ * size was taken, yields a buffer as long as what was read.
+ */
+bool
+EventLoop::advanceFileOp(VM::Interpreter &interp, size_t slot, ssize_t res)
+{
+	FileOp &op = m_ops[slot];
+
+	if (res < 0)
+		finishFileOp(interp, slot, -res);
+	else if (res == 0 && !op.m_write) {
+		m_opOops[slot * 2 + 1].addrT<ArrayBuffer>()->m_byteLength =
+		    op.m_done;
+		finishFileOp(interp, slot, 0);
+	} else if (res == 0)
+		finishFileOp(interp, slot, EIO);
+	else if ((op.m_done += res) == op.m_len)
+		finishFileOp(interp, slot, 0);
+	else
+		return false;
+
+	return true;
+}
+
+void
+EventLoop::finishFileOp(VM::Interpreter &interp, size_t slot, int err)
+{
+	FileOp &op = m_ops[slot];
+	HandleScope scope(m_omemt);
+	Handle<Promise> promise(m_omemt, m_opOops[slot * 2]);
+	Oop buffer = m_opOops[slot * 2 + 1];
+	bool write = op.m_write;
+	size_t done = op.m_done;
+	Oop val;
+
+	close(op.m_fd);
+	m_opOops[slot * 2] = ObjectMemory::s_undefined;
+	m_opOops[slot * 2 + 1] = ObjectMemory::s_undefined;
+	m_pinned[slot] = NULL;
+	m_freeOps.push_back(slot);
+	m_nOps--;
+
+	if (err) {
+		std::string txt("Error: ");
+
+		txt += strerror(err);
+		val = m_omemt.makeString(txt.c_str());
+	} else if (write)
+		val = m_omemt.makeDouble(done);
+	else
+		val = buffer;
+	interp.settle(promise, err ? Promise::kRejected : Promise::kFulfilled,
+	    val);
+}
+
+size_t
+EventLoop::reapFileOps(VM::Interpreter &interp)
+{
+	struct io_uring_cqe cqe;
+	size_t n = 0;
+
+	while (m_ring.reap(cqe)) {
+		size_t slot = cqe.user_data;
+
+		n++;
+		if (!advanceFileOp(interp, slot, cqe.res) &&
+		    !submitFileOp(slot))
+			runFileOp(interp, slot);
+	}
+
+	return n;
+}
+
+/*
+ * Each call runs at most one timer, so that the microtasks queued by one
+ * timer's callback run before the next timer's. Completed I/O takes priority
+ * over timers, and settling its promises only queues microtasks, so all that
+ * is available is handled at once.
+ */
+bool
+EventLoop::poll(VM::Interpreter &interp, bool wait)
+{
+	size_t nReaped = 0;
+
+	if (m_omemt.omem().epoch() != m_cleanedEpoch)
+		nReaped = cleanupRegistries(interp);
+	if (m_nOps > 0) {
+		m_ring.submit();
+		nReaped += reapFileOps(interp);
+	}
+	if (m_timers.empty() && m_nOps == 0)
+		return nReaped > 0;
+
+	uint64_t now = monotonicMillis();
+
+	if (!m_timers.empty() && m_timers.front().m_when <= now) {
+		fire(interp);
+		return true;
+	} else if (!wait || nReaped > 0)
+		return true;
+
+	/*
+	 * The wait ends by the interpreter's deadline, so that the safepoint
+	 * the interpreter passes next can terminate the script on time.
+	 */
+	uint64_t until = m_timers.empty() ? 0 : m_timers.front().m_when;
+
+	if (interp.deadline() && (!until || interp.deadline() < until))
+		until = interp.deadline();
+
+	/*
+	 * Before waiting, give the time to the collector; if it needed all of
+	 * it, come round again rather than wait.
+	 */
+	uint64_t idleUntil = now + kIdleSliceMillis;
+
+	if (until && until < idleUntil)
+		idleUntil = until;
+	if (m_omemt.idle(idleUntil * 1000))
+		return true;
+
+	now = monotonicMillis();
+	if (!m_timers.empty() && m_timers.front().m_when <= now) {
+		fire(interp);
+		return true;
+	} else if (until && until <= now)
+		return true;
+
+	waitUntil(until, now);
+	if (m_nOps > 0)
+		reapFileOps(interp);
+
+	if (!m_timers.empty() && m_timers.front().m_when <= monotonicMillis())
+		fire(interp);
+	return true;
+}
+
+/*
+ * In-progress I/O is always on the ring (see startFileOp()), whose descriptor
+ * polls readable once there are completions to reap.
+ */
+void
+EventLoop::waitUntil(uint64_t until, uint64_t now)
+{
+	struct pollfd fds[2];
+	nfds_t nFds = 1;
+	int timeout = -1;
+	uint64_t count;
+
+	fds[0].fd = m_wakeFd;
+	fds[0].events = POLLIN;
+	if (m_nOps > 0) {
+		m_ring.submit();
+		fds[1].fd = m_ring.fd();
+		fds[1].events = POLLIN;
+		nFds++;
+	}
+	if (until)
+		timeout = until - now > INT_MAX ? INT_MAX : until - now;
+
+	/* on EINTR, the caller comes round again */
+	::poll(fds, nFds, timeout);
+	if (read(m_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		FATAL("couldn't read eventfd: %s", strerror(errno));
+}
+
+void
+EventLoop::wake()
+{
+	uint64_t one = 1;
+
+	if (write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		FATAL("couldn't write eventfd: %s", strerror(errno));
+}
+
+/*
+ * Registries do not move, being in the AWL pool, so queueing microtasks does
+ * not disturb the walk.
+ */
+size_t
+EventLoop::cleanupRegistries(VM::Interpreter &interp)
+{
+	size_t n = 0, j = 0;
+
+	m_cleanedEpoch = m_omemt.omem().epoch();
+	for (size_t i = 0; i < m_registries.size(); i++) {
+		if (m_registries[i].isUndefined())
+			continue;
+		n += m_registries[i].addrT<FinalizationRegistry>()->cleanup(
+		    interp);
+		m_registries[j++] = m_registries[i];
+	}
+	m_registries.resize(j);
+
+	return n;
+}
+
+Oop
+EventLoop::setTimeout(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	EventLoop *loop = (EventLoop *)data;
+
+	if (nArgs < 1)
+		return ObjectMemory::s_undefined;
+	return interp.omemt().makeDouble(loop->addTimer(nArgs > 1 ?
+	    toMillis(args[1]) : 0, args[0]));
+}
+
+Oop
+EventLoop::queueMicrotask(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs >= 1)
+		interp.enqueueMicrotask(args[0], ObjectMemory::s_undefined);
+	return ObjectMemory::s_undefined;
+}
+
+Oop
+EventLoop::sleep(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	EventLoop *loop = (EventLoop *)data;
+	MemOop<Promise> promise = interp.omemt().makePromise();
+
+	loop->addTimer(nArgs >= 1 ? toMillis(args[0]) : 0, promise);
+	return promise;
+}
+
+/*
+ * The reason is made before the promise is read back, as making it may move
+ * the promise.
+ */
+static Oop
+reject(VM::Interpreter &interp, Handle<Promise> promise, const char *reason)
+{
+	PrimOop err = interp.omemt().makeString(reason);
+
+	interp.settle(promise, Promise::kRejected, err);
+	return *promise;
+}
+
+Oop
+EventLoop::readFile(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	EventLoop *loop = (EventLoop *)data;
+	HandleScope scope(interp.omemt());
+	Handle<Promise> promise(interp.omemt(), interp.omemt().makePromise());
+	MemOop<ArrayBuffer> buf;
+	struct stat sb;
+	int fd;
+
+	if (nArgs < 1 || args[0].tag() != Oop::kString)
+		return reject(interp, promise, "TypeError: path not a string");
+
+	fd = open(args[0].addrT<PrimDesc>()->m_str, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &sb) < 0) {
+		std::string txt("Error: ");
+
+		txt += strerror(errno);
+		if (fd >= 0)
+			close(fd);
+		return reject(interp, promise, txt.c_str());
+	}
+
+	buf = interp.omemt().makeArrayBuffer(sb.st_size);
+	loop->startFileOp(interp, fd, false, buf->m_store.addrT<void>(),
+	    buf->m_store->bytes(), sb.st_size, promise, buf);
+
+	return *promise;
+}
+
+Oop
+EventLoop::writeFile(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	EventLoop *loop = (EventLoop *)data;
+	HandleScope scope(interp.omemt());
+	Handle<Promise> promise(interp.omemt(), interp.omemt().makePromise());
+	PrimDesc *pinned;
+	char *bytes;
+	size_t len;
+	int fd;
+
+	if (nArgs < 2 || args[0].tag() != Oop::kString)
+		return reject(interp, promise, "TypeError: path not a string");
+
+	if (args[1].tag() == Oop::kString) {
+		pinned = args[1].addrT<PrimDesc>();
+		bytes = pinned->m_str;
+		len = pinned->m_strLen;
+	} else if (args[1].tag() == Oop::kObject &&
+	    args[1].addrT<ObjectDesc>()->m_kind == ObjectDesc::kArrayBuffer) {
+		ArrayBuffer *buf = args[1].addrT<ArrayBuffer>();
+
+		/* external contents don't move, but mustn't be released */
+		pinned = buf->m_store.isUndefined() ? NULL :
+		    buf->m_store.addrT<PrimDesc>();
+		bytes = buf->data();
+		len = buf->m_byteLength;
+	} else
+		return reject(interp, promise,
+		    "TypeError: data not an ArrayBuffer or string");
+
+	fd = open(args[0].addrT<PrimDesc>()->m_str,
+	    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		std::string txt("Error: ");
+
+		txt += strerror(errno);
+		return reject(interp, promise, txt.c_str());
+	}
+
+	loop->startFileOp(interp, fd, true, pinned, bytes, len, promise,
+	    args[1]);
+
+	return *promise;
+}
+
+static void
+unmapBytes(void *data, size_t len)
+{
+	munmap(data, len);
+}
+
+/*
+ * The mapping is private and read-only, so the contents are paged in from the
+ * file as they are touched and never count against the heap.
+ */
+Oop
+EventLoop::mapFile(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	struct stat sb;
+	void *bytes = NULL;
+	int fd;
+
+	if (nArgs < 1 || args[0].tag() != Oop::kString)
+		return interp.nativeThrow(interp.omemt().makeString(
+		    "TypeError: path not a string"));
+
+	fd = open(args[0].addrT<PrimDesc>()->m_str, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &sb) < 0 || (sb.st_size > 0 &&
+	    (bytes = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+		MAP_FAILED)) {
+		std::string txt("Error: ");
+
+		txt += strerror(errno);
+		if (fd >= 0)
+			close(fd);
+		return interp.nativeThrow(interp.omemt().makeString(
+		    txt.c_str()));
+	}
+	close(fd);
+
+	return interp.omemt().makeExternalArrayBuffer(bytes,
+	    bytes ? sb.st_size : 0, bytes ? unmapBytes : NULL);
+}
+
+Oop
+EventLoop::byteLength(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs < 1 || args[0].tag() != Oop::kObject ||
+	    args[0].addrT<ObjectDesc>()->m_kind != ObjectDesc::kArrayBuffer)
+		return ObjectMemory::s_undefined;
+	return interp.omemt().makeDouble(
+	    args[0].addrT<ArrayBuffer>()->m_byteLength);
+}
+
+Oop
+EventLoop::gcStats(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	ObjectMemoryOSThread &omemt = interp.omemt();
+	std::string json = omemt.omem().telemetry().toJSON();
+
+	/* add the large objects and sites as members of the same object */
+	json.insert(json.size() - 1, ",\"largeObjects\":" +
+	    omemt.largeObjectsJSON() + ",\"allocSites\":" +
+	    omemt.omem().allocSitesJSON());
+
+	return omemt.makeString(json.c_str());
+}
+
+static inline bool
+isKind(Oop val, ObjectDesc::Kind kind)
+{
+	return val.tag() == Oop::kObject &&
+	    val.addrT<ObjectDesc>()->m_kind == kind;
+}
+
+static Oop
+typeError(VM::Interpreter &interp, const char *what)
+{
+	std::string txt("TypeError: ");
+
+	txt += what;
+	return interp.nativeThrow(interp.omemt().makeString(txt.c_str()));
+}
+
+Oop
+EventLoop::weakRef(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs < 1 || args[0].tag() != Oop::kObject)
+		return typeError(interp, "target not an object");
+	return interp.omemt().makeWeakRef(args[0]);
+}
+
+Oop
+EventLoop::deref(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs < 1 || !isKind(args[0], ObjectDesc::kWeakRef))
+		return typeError(interp, "not a WeakRef");
+	return args[0].addrT<WeakRef>()->m_target;
+}
+
+Oop
+EventLoop::weakMap(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	return interp.omemt().makeWeakMap();
+}
+
+/*
+ * Keys which are not objects cannot be in a WeakMap; only weakMapSet() throws
+ * for them.
+ */
+Oop
+EventLoop::weakMapGet(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs < 1 || !isKind(args[0], ObjectDesc::kWeakMap))
+		return typeError(interp, "not a WeakMap");
+	if (nArgs < 2 || args[1].tag() != Oop::kObject)
+		return ObjectMemory::s_undefined;
+	return args[0].addrT<WeakMap>()->get(interp.omemt(), args[1]);
+}
+
+Oop
+EventLoop::weakMapSet(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs < 1 || !isKind(args[0], ObjectDesc::kWeakMap))
+		return typeError(interp, "not a WeakMap");
+	if (nArgs < 2 || args[1].tag() != Oop::kObject)
+		return typeError(interp, "key not an object");
+	args[0].addrT<WeakMap>()->set(interp.omemt(), args[1],
+	    nArgs > 2 ? args[2] : ObjectMemory::s_undefined);
+	return args[0];
+}
+
+Oop
+EventLoop::weakMapHas(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs < 1 || !isKind(args[0], ObjectDesc::kWeakMap))
+		return typeError(interp, "not a WeakMap");
+	return nArgs >= 2 && args[1].tag() == Oop::kObject &&
+		args[0].addrT<WeakMap>()->has(interp.omemt(), args[1]) ?
+	    ObjectMemory::s_true : ObjectMemory::s_false;
+}
+
+Oop
+EventLoop::weakMapDelete(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs < 1 || !isKind(args[0], ObjectDesc::kWeakMap))
+		return typeError(interp, "not a WeakMap");
+	return nArgs >= 2 && args[1].tag() == Oop::kObject &&
+		args[0].addrT<WeakMap>()->remove(interp.omemt(), args[1]) ?
+	    ObjectMemory::s_true : ObjectMemory::s_false;
+}
+
+Oop
+EventLoop::finalizationRegistry(VM::Interpreter &interp, void *data,
+    Oop *args, size_t nArgs)
+{
+	EventLoop *loop = (EventLoop *)data;
+	MemOop<FinalizationRegistry> reg;
+
+	if (nArgs < 1 || args[0].tag() != Oop::kObject)
+		return typeError(interp, "callback not a function");
+	reg = interp.omemt().makeFinalizationRegistry(args[0]);
+	loop->m_registries.push_back(reg);
+	return reg;
+}
+
+Oop
+EventLoop::registerFinalizer(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	if (nArgs < 1 || !isKind(args[0], ObjectDesc::kFinalizationRegistry))
+		return typeError(interp, "not a FinalizationRegistry");
+	if (nArgs < 2 || args[1].tag() != Oop::kObject)
+		return typeError(interp, "target not an object");
+	args[0].addrT<FinalizationRegistry>()->add(interp.omemt(), args[1],
+	    nArgs > 2 ? args[2] : ObjectMemory::s_undefined);
+	return ObjectMemory::s_undefined;
+}
+
+/* The path is copied, as the collection may move it. */
+Oop
+EventLoop::heapSnapshot(VM::Interpreter &interp, void *data, Oop *args,
+    size_t nArgs)
+{
+	std::string path;
+
+	if (nArgs < 1 || args[0].tag() != Oop::kString)
+		return typeError(interp, "path not a string");
+	path = args[0].addrT<PrimDesc>()->m_str;
+
+	if (!interp.omemt().writeHeapSnapshot(path.c_str())) {
+		std::string txt("Error: ");
+
+		txt += strerror(errno);
+		return interp.nativeThrow(
+		    interp.omemt().makeString(txt.c_str()));
+	}
+	return ObjectMemory::s_true;
+}
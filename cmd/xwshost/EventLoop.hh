@@ -0,0 +1,225 @@
+#ifndef EVENTLOOP_HH_
+#define EVENTLOOP_HH_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+#include "IOUring.hh"
+#include "Object.h"
+
+#include "ObjectMemory.hh"
+
+namespace VM {
+class Interpreter;
+}
+
+/**
+ * The host's event loop, which supplies the script's host functions and the
+ * timers and file I/O they start. The interpreter polls it between batches of
+ * microtasks, and waits on it once there are none.
+ *
+ * File I/O is submitted through io_uring, straight to and from the bytes of
+ * ArrayBuffers. Where io_uring is unavailable it is instead done synchronously
+ * when requested; regular files cannot be waited on with epoll, so nothing is
+ * to be gained there from readiness polling.
+ */
+class EventLoop {
+	struct Timer {
+		uint64_t m_when; /**< CLOCK_MONOTONIC deadline, in ms */
+		uint64_t m_seq;	 /**< orders timers with the same deadline */
+		size_t m_slot;	 /**< index of its target in #m_targets */
+
+		/**
+		 * Whether this expires after \p other; so the standard heap
+		 * algorithms keep the earliest timer at the front.
+		 */
+		bool operator<(const Timer &other) const;
+	};
+
+	/** A file read or write in progress. */
+	struct FileOp {
+		int m_fd;
+		bool m_write;
+		char *m_data;
+		size_t m_len;
+		size_t m_done; /**< bytes transferred so far */
+	};
+
+	/** Size of the io_uring submission queue. */
+	static const unsigned kRingEntries = 64;
+	/** Most bytes moved by one read or write, as the kernel allows. */
+	static const size_t kMaxTransfer = 0x7ffff000;
+	/**
+	 * Longest the loop gives to collection at a time when it would wait,
+	 * as I/O may complete meanwhile.
+	 */
+	static const uint64_t kIdleSliceMillis = 5;
+
+	ObjectMemoryOSThread &m_omemt;
+	/** Pending timers, as a binary heap with the earliest at the front. */
+	std::vector<Timer> m_timers;
+	/**
+	 * What each timer does on expiry: a Promise is fulfilled, anything
+	 * else queued as a microtask. Kept apart from #m_timers so that it can
+	 * be scanned as an ordinary root; freed slots are undefined.
+	 */
+	std::vector<Oop> m_targets;
+	std::vector<size_t> m_freeSlots;
+	uint64_t m_nextSeq;
+	mps_root_t m_mpsRoot;
+
+	IOUring m_ring;
+	/**
+	 * File operations, by slot. Each slot's Oops, in #m_opOops, are its
+	 * Promise and the ArrayBuffer read into, or undefined; its entry in
+	 * #m_pinned is the object holding its bytes, which must not move while
+	 * the kernel may access them.
+	 */
+	std::vector<FileOp> m_ops;
+	std::vector<Oop> m_opOops;
+	std::vector<void *> m_pinned;
+	std::vector<size_t> m_freeOps;
+	size_t m_nOps; /**< in progress */
+	mps_root_t m_mpsOpsRoot, m_mpsPinnedRoot;
+
+	/**
+	 * FinalizationRegistries, held weakly so that they may die (and their
+	 * callbacks with them); those that have are undefined.
+	 */
+	std::vector<Oop> m_registries;
+	mps_root_t m_mpsRegistriesRoot;
+	/** ObjectMemory::epoch() as of the last cleanupRegistries(). */
+	uint32_t m_cleanedEpoch;
+	/** An eventfd, written to by wake() to end a wait early. */
+	int m_wakeFd;
+
+	/** Run \p target after \p delay ms; returns the timer's sequence. */
+	uint64_t addTimer(uint64_t delay, Oop target);
+	/** Remove the earliest timer and run its target. */
+	void fire(VM::Interpreter &interp);
+
+	/**
+	 * Start reading into, or writing from, the \p len bytes at \p data,
+	 * which lie in \p pinned; \p promise is settled when done.
+	 */
+	void startFileOp(VM::Interpreter &interp, int fd, bool write,
+	    void *pinned, char *data, size_t len, MemOop<Promise> promise,
+	    Oop buffer);
+	/** Queue the rest of the operation in \p slot to the ring. */
+	bool submitFileOp(size_t slot);
+	/** Do the operation in \p slot synchronously, then finish it. */
+	void runFileOp(VM::Interpreter &interp, size_t slot);
+	/**
+	 * Account for \p res, as returned by read() or write(), to the
+	 * operation in \p slot; returns whether it is finished.
+	 */
+	bool advanceFileOp(VM::Interpreter &interp, size_t slot,
+	    ssize_t res);
+	/** Settle the operation in \p slot, failed with \p err if nonzero. */
+	void finishFileOp(VM::Interpreter &interp, size_t slot, int err);
+	/** Handle available completions; returns how many there were. */
+	size_t reapFileOps(VM::Interpreter &interp);
+	/**
+	 * Wait until \p until, a monotonicMillis() time (0 for no limit),
+	 * \p now being the time, for I/O to complete or for a wake().
+	 */
+	void waitUntil(uint64_t until, uint64_t now);
+	/**
+	 * Queue the callbacks for targets that have died since the last call,
+	 * and forget registries that have died; returns how many were queued.
+	 */
+	size_t cleanupRegistries(VM::Interpreter &interp);
+
+	static Oop setTimeout(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop queueMicrotask(VM::Interpreter &interp, void *data,
+	    Oop *args, size_t nArgs);
+	static Oop sleep(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop readFile(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop writeFile(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop mapFile(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop byteLength(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop gcStats(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop weakRef(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop deref(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop weakMap(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop weakMapGet(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop weakMapSet(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop weakMapHas(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+	static Oop weakMapDelete(VM::Interpreter &interp, void *data,
+	    Oop *args, size_t nArgs);
+	static Oop finalizationRegistry(VM::Interpreter &interp, void *data,
+	    Oop *args, size_t nArgs);
+	static Oop registerFinalizer(VM::Interpreter &interp, void *data,
+	    Oop *args, size_t nArgs);
+	static Oop heapSnapshot(VM::Interpreter &interp, void *data,
+	    Oop *args, size_t nArgs);
+
+    public:
+	/**
+	 * Without \p useRing, file I/O is done synchronously even where
+	 * io_uring is available.
+	 */
+	EventLoop(ObjectMemoryOSThread &omemt, bool useRing = true);
+	~EventLoop();
+
+	/**
+	 * Make the environment of host functions in which scripts are to be
+	 * run:
+	 *
+	 * - setTimeout(fn, ms) and queueMicrotask(fn);
+	 * - sleep(ms), a Promise fulfilled after \p ms ms;
+	 * - readFile(path), a Promise of an ArrayBuffer of the file's contents;
+	 * - writeFile(path, data), a Promise of the number of bytes written
+	 *   from \p data, an ArrayBuffer or string;
+	 * - mapFile(path), an ArrayBuffer of the file's contents, mapped
+	 *   into memory rather than read into the heap;
+	 * - byteLength(buffer);
+	 * - gcStats(), a JSON string of the collector's counters and pause
+	 *   times; see GCTelemetry;
+	 * - weakRef(target), a WeakRef, and deref(ref), its target or, once
+	 *   that has died, undefined;
+	 * - weakMap(), a WeakMap, with weakMapGet(map, key),
+	 *   weakMapSet(map, key, value), weakMapHas(map, key) and
+	 *   weakMapDelete(map, key);
+	 * - finalizationRegistry(fn), a FinalizationRegistry, and
+	 *   registerFinalizer(registry, target, held), after which \p fn is
+	 *   called with \p held some time after \p target dies;
+	 * - heapSnapshot(path), which collects the heap and writes a snapshot
+	 *   of it to \p path for xwsheap to analyse, returning true.
+	 *
+	 * Targets and keys must be objects.
+	 */
+	MemOop<Environment> makeGlobals();
+
+	/**
+	 * Queue the callbacks of FinalizationRegistries if there has been a
+	 * collection since the last poll. Submit queued I/O and handle
+	 * completed I/O; failing that, run the earliest timer if it is due.
+	 * If \p wait and none of these, spend the time on collection (see
+	 * ObjectMemoryOSThread::idle()), then wait for I/O or a timer, but
+	 * not past the interpreter's deadline nor once woken. Returns false
+	 * if there were no callbacks and are neither timers nor I/O pending.
+	 */
+	bool poll(VM::Interpreter &interp, bool wait);
+	/**
+	 * End the current or next wait of poll() early. May be called from
+	 * any thread.
+	 */
+	void wake();
+};
+
+#endif /* EVENTLOOP_HH_ */
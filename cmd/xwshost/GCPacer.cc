@@ -0,0 +1,326 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "GCPacer.hh"
+
+/** Time over which the allocation rate is averaged, in seconds. */
+static const double kRateWindow = 1.0;
+/** Weight of each collection in the average survival of the nursery. */
+static const double kSurvivalWeight = 0.3;
+/** Survival beyond which the nursery is not grown further for it. */
+static const double kMaxSurvival = 0.75;
+
+HeapConfig::HeapConfig()
+    : m_arenaKB(32 * 1024)
+    , m_commitLimitKB(0)
+    , m_spare(0.75)
+    , m_hugePages(false)
+    , m_largeObjectKB(64)
+    , m_codeSpaceKB(16 * 1024)
+    , m_nGenerations(3)
+    , m_maxNurseryKB(64 * 1024)
+    , m_minorIntervalMillis(50)
+    , m_heapGrowth(2.0)
+    , m_minFullKB(32 * 1024)
+    , m_stepMillis(1)
+    , m_deferToIdle(false)
+    , m_pretenure(true)
+{
+	for (size_t i = 0; i < m_nGenerations; i++) {
+		m_gens[i].mps_capacity = 6400;
+		m_gens[i].mps_mortality = 0.80;
+	}
+}
+
+static bool
+parseNumber(const char *txt, double &val)
+{
+	char *end;
+
+	val = strtod(txt, &end);
+	return end != txt && (*end == '\0' || *end == ':' || *end == '/') &&
+	    val >= 0;
+}
+
+static bool
+parseSize(const char *txt, size_t &val)
+{
+	double dbl;
+
+	if (!parseNumber(txt, dbl))
+		return false;
+	val = dbl;
+	return true;
+}
+
+/* e.g. 6400:0.8/16000:0.5 */
+static bool
+parseGens(const char *txt, HeapConfig &config)
+{
+	size_t n = 0;
+
+	while (*txt) {
+		const char *colon = strchr(txt, ':'), *slash;
+		double mortality;
+
+		if (n == HeapConfig::kMaxGenerations || !colon ||
+		    !parseSize(txt, config.m_gens[n].mps_capacity) ||
+		    !parseNumber(colon + 1, mortality) || mortality > 1)
+			return false;
+		config.m_gens[n++].mps_mortality = mortality;
+
+		slash = strchr(colon, '/');
+		txt = slash ? slash + 1 : colon + strlen(colon);
+	}
+	if (n == 0)
+		return false;
+	config.m_nGenerations = n;
+
+	return true;
+}
+
+static bool
+parseFlag(const char *txt, bool &val)
+{
+	double dbl;
+
+	if (!parseNumber(txt, dbl) || dbl > 1)
+		return false;
+	val = dbl != 0;
+	return true;
+}
+
+static bool
+parseSetting(const std::string &key, const char *val, HeapConfig &config)
+{
+	if (key == "arena")
+		return parseSize(val, config.m_arenaKB);
+	else if (key == "commitLimit")
+		return parseSize(val, config.m_commitLimitKB);
+	else if (key == "spare")
+		return parseNumber(val, config.m_spare) && config.m_spare <= 1;
+	else if (key == "hugePages")
+		return parseFlag(val, config.m_hugePages);
+	else if (key == "largeObject")
+		return parseSize(val, config.m_largeObjectKB) &&
+		    config.m_largeObjectKB > 0;
+	else if (key == "codeSpace")
+		return parseSize(val, config.m_codeSpaceKB) &&
+		    config.m_codeSpaceKB > 0;
+	else if (key == "gens")
+		return parseGens(val, config);
+	else if (key == "maxNursery")
+		return parseSize(val, config.m_maxNurseryKB);
+	else if (key == "minorInterval")
+		return parseNumber(val, config.m_minorIntervalMillis);
+	else if (key == "heapGrowth")
+		return parseNumber(val, config.m_heapGrowth) &&
+		    config.m_heapGrowth >= 1;
+	else if (key == "minFull")
+		return parseSize(val, config.m_minFullKB);
+	else if (key == "step")
+		return parseNumber(val, config.m_stepMillis);
+	else if (key == "deferToIdle")
+		return parseFlag(val, config.m_deferToIdle);
+	else if (key == "pretenure")
+		return parseFlag(val, config.m_pretenure);
+	return false;
+}
+
+bool
+HeapConfig::parse(const char *spec)
+{
+	std::string txt(spec);
+	size_t pos = 0;
+
+	while (pos < txt.size()) {
+		size_t end = txt.find(',', pos), eq;
+		std::string item;
+
+		if (end == std::string::npos)
+			end = txt.size();
+		item = txt.substr(pos, end - pos);
+		eq = item.find('=');
+		if (eq == std::string::npos ||
+		    !parseSetting(item.substr(0, eq), item.c_str() + eq + 1,
+			*this))
+			return false;
+		pos = end + 1;
+	}
+
+	return true;
+}
+
+GCPacer::GCPacer(const HeapConfig &config, GCTelemetry &telemetry)
+    : m_config(config)
+    , m_arena(NULL)
+    , m_telemetry(telemetry)
+    , m_busy(false)
+    , m_rate(0)
+    , m_survival(0)
+    , m_lastBytes(0)
+    , m_lastClock(0)
+    , m_minorBase(0)
+    , m_fullBase(0)
+    , m_fullLive(0)
+{
+}
+
+void
+GCPacer::attach(mps_arena_t arena)
+{
+	m_arena = arena;
+	m_lastClock = mps_clock();
+	mps_arena_clamp(arena);
+}
+
+uint64_t
+GCPacer::nurseryTarget() const
+{
+	double min = m_config.m_gens[0].mps_capacity * 1024.0;
+	double max = m_config.m_maxNurseryKB * 1024.0;
+	double survival = m_survival < kMaxSurvival ? m_survival : kMaxSurvival;
+	double target = m_rate * m_config.m_minorIntervalMillis / 1000 /
+	    (1 - survival);
+
+	if (target > max)
+		target = max;
+	if (target < min)
+		target = min;
+	return target;
+}
+
+/*
+ * Stepping the arena starts a collection of any generation that has exceeded
+ * its capacity, so while the nursery is below its target size (which is at
+ * least its capacity) the arena is not stepped except to advance collections
+ * already under way. A multiplier of 0 keeps the MPS from deciding to collect
+ * the whole heap itself.
+ */
+void
+GCPacer::pace(uint64_t bytesAllocated)
+{
+	mps_clock_t now = mps_clock();
+	double secs = (double)(now - m_lastClock) / mps_clocks_per_sec();
+	double step = m_config.m_stepMillis / 1000;
+	uint64_t fullBudget;
+
+	if (secs > 0) {
+		double rate = (bytesAllocated - m_lastBytes) / secs;
+
+		m_rate += (rate - m_rate) * secs / (secs + kRateWindow);
+		m_lastBytes = bytesAllocated;
+		m_lastClock = now;
+	}
+
+	if (m_config.m_deferToIdle && hasHeadroom(bytesAllocated))
+		return;
+
+	if (m_busy) {
+		m_busy = mps_arena_step(m_arena, step, 0);
+		paused(now);
+		return;
+	}
+
+	fullBudget = m_fullLive * (m_config.m_heapGrowth - 1);
+	if (fullBudget < m_config.m_minFullKB * 1024)
+		fullBudget = m_config.m_minFullKB * 1024;
+
+	if (bytesAllocated - m_minorBase >= nurseryTarget()) {
+		m_minorBase = bytesAllocated;
+		m_busy = mps_arena_step(m_arena, step, 0);
+		paused(now);
+	} else if (bytesAllocated - m_fullBase >= fullBudget) {
+		m_fullBase = bytesAllocated;
+		m_busy = mps_arena_start_collect(m_arena) == MPS_RES_OK;
+		/* which unclamps it */
+		mps_arena_clamp(m_arena);
+		paused(now);
+	}
+}
+
+/*
+ * Each step is given what remains of the budget, so normally the first takes
+ * all of it. A multiplier of 1 lets the MPS start a full collection if it
+ * estimates that one would fit within the budget.
+ */
+bool
+GCPacer::idle(double budget)
+{
+	mps_clock_t start = mps_clock();
+	double spent = 0;
+
+	while (spent < budget) {
+		mps_clock_t stepStart = mps_clock();
+
+		m_busy = mps_arena_step(m_arena, budget - spent, 1);
+		paused(stepStart);
+		if (!m_busy)
+			break;
+		spent = (double)(mps_clock() - start) / mps_clocks_per_sec();
+	}
+
+	return m_busy;
+}
+
+/* mps_arena_collect() leaves the arena parked. */
+void
+GCPacer::collect(uint64_t bytesAllocated)
+{
+	mps_clock_t start = mps_clock();
+
+	mps_arena_collect(m_arena);
+	mps_arena_clamp(m_arena);
+	paused(start);
+	m_busy = false;
+	m_minorBase = m_fullBase = bytesAllocated;
+}
+
+void
+GCPacer::collected(GCTelemetry::Cause cause, uint64_t bytesAllocated,
+    size_t condemned, size_t live)
+{
+	if (cause == GCTelemetry::kMinor && condemned > 0)
+		m_survival += ((double)live / condemned - m_survival) *
+		    kSurvivalWeight;
+	else if (cause == GCTelemetry::kFull) {
+		m_fullLive = live;
+		m_fullBase = bytesAllocated;
+	}
+	m_minorBase = bytesAllocated;
+}
+
+void
+GCPacer::paused(mps_clock_t start)
+{
+	m_telemetry.recordPause((uint64_t)(mps_clock() - start) * 1000000 /
+	    mps_clocks_per_sec());
+}
+
+bool
+GCPacer::hasHeadroom(uint64_t bytesAllocated) const
+{
+	return bytesAllocated - m_minorBase < m_config.m_maxNurseryKB * 1024 &&
+	    !nearLimit();
+}
+
+/* The arena gives up spare memory before it fails to commit more. */
+bool
+GCPacer::nearLimit() const
+{
+	size_t limit = mps_arena_commit_limit(m_arena);
+
+	return mps_arena_committed(m_arena) -
+	    mps_arena_spare_committed(m_arena) >= limit - limit / 4;
+}
+
+bool
+GCPacer::setCommitLimit(size_t kb)
+{
+	if (mps_arena_commit_limit_set(m_arena,
+		kb ? kb * 1024 : ~(size_t)0) != MPS_RES_OK)
+		return false;
+	m_config.m_commitLimitKB = kb;
+	return true;
+}
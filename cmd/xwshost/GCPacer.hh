@@ -0,0 +1,185 @@
+#ifndef GCPACER_HH_
+#define GCPACER_HH_
+
+#include <stdint.h>
+
+extern "C" {
+#include "mps.h"
+}
+
+#include "GCTelemetry.hh"
+
+/**
+ * Configuration of the heap: its generations, the arena, and how collections
+ * are paced. Sizes are in KB, as the MPS takes generation capacities.
+ */
+struct HeapConfig {
+	static const size_t kMaxGenerations = 8;
+	/** Size of a transparent huge page on x86-64 and arm64 Linux. */
+	static const size_t kHugePageKB = 2048;
+
+	/** Size of the arena's initial address space. */
+	size_t m_arenaKB;
+	/**
+	 * Limit on memory the arena may commit, the heap limit; 0 means none.
+	 * See HeapLimitCallback for what happens on reaching it.
+	 */
+	size_t m_commitLimitKB;
+	/**
+	 * Memory freed by collection which the arena may keep committed for
+	 * reuse, rather than return to the OS, as a fraction of that in use.
+	 */
+	double m_spare;
+	/**
+	 * Whether to back the heap with transparent huge pages: the arena's
+	 * grain is made a huge page, so that every segment is huge-page
+	 * aligned, and the pages allocated into are madvise()d. Each pool's
+	 * segments are then at least a huge page, so small heaps waste
+	 * memory; large ones take fewer TLB misses when scanned.
+	 */
+	bool m_hugePages;
+	/**
+	 * Size at and above which objects are allocated in the pools which
+	 * do not move them; see ObjectMemory.
+	 */
+	size_t m_largeObjectKB;
+	/**
+	 * Capacity of the code space's one generation: how much code may be
+	 * made before it is first collected.
+	 */
+	size_t m_codeSpaceKB;
+
+	size_t m_nGenerations;
+	/**
+	 * Capacities and mortalities of the generation chain. That of the
+	 * nursery is the smallest it may be; see GCPacer.
+	 */
+	mps_gen_param_s m_gens[kMaxGenerations];
+
+	/** Largest the nursery may grow to. */
+	size_t m_maxNurseryKB;
+	/** Interval at which to aim to collect the nursery, in ms. */
+	double m_minorIntervalMillis;
+	/**
+	 * Collect the whole heap once allocation since the last full
+	 * collection exceeds this multiple of what survived it...
+	 */
+	double m_heapGrowth;
+	/** ...or this, if more. */
+	size_t m_minFullKB;
+	/** Time to spend on collection work at each safepoint, in ms. */
+	double m_stepMillis;
+	/**
+	 * Whether to leave collection to idle time (see GCPacer::idle())
+	 * for as long as the heap has headroom.
+	 */
+	bool m_deferToIdle;
+	/** Whether to pretenure allocation sites; see AllocSite. */
+	bool m_pretenure;
+
+	HeapConfig();
+
+	/**
+	 * Apply \p spec, a comma-separated list of settings of the form
+	 * key=value, where a key is one of arena, commitLimit, spare,
+	 * hugePages, largeObject, codeSpace, gens (a list of
+	 * capacity:mortality separated by slashes), maxNursery,
+	 * minorInterval, heapGrowth, minFull, step, deferToIdle and
+	 * pretenure (hugePages and the last two 0 or 1). Returns false,
+	 * having applied those before it, at the first it does not
+	 * understand.
+	 */
+	bool parse(const char *spec);
+};
+
+/**
+ * Decides when the collector runs. The arena is kept clamped so that the MPS
+ * starts no collections of its own accord; instead, at each safepoint, the
+ * pacer:
+ *
+ * - advances any collection in progress by a step of #m_stepMillis;
+ * - steps the arena, so starting a collection of the nursery, once the
+ *   bytes allocated since the last have reached the nursery's target size;
+ * - failing that, starts a full collection once the heap has grown by the
+ *   configured factor since the last.
+ *
+ * The target size of the nursery is the allocation to be expected in one
+ * minor collection interval at the observed rate, scaled up as more of the
+ * nursery is seen to survive (so that objects are given longer to die), and
+ * bounded below by the nursery's capacity and above by #m_maxNurseryKB.
+ *
+ * With HeapConfig::m_deferToIdle, the pacer does none of this while there is
+ * headroom, so that the work falls to idle().
+ *
+ * Each call into the collector is timed, and reported to the GCTelemetry as a
+ * pause.
+ */
+class GCPacer {
+	HeapConfig m_config;
+	mps_arena_t m_arena;
+	GCTelemetry &m_telemetry;
+
+	/** Whether a collection is under way, as of the last step. */
+	bool m_busy;
+
+	/** Allocation rate, a moving average in bytes per second. */
+	double m_rate;
+	/** Fraction of the nursery surviving, a moving average. */
+	double m_survival;
+
+	/** Bytes allocated and mps_clock() at the last pace(). */
+	uint64_t m_lastBytes;
+	mps_clock_t m_lastClock;
+	/** Bytes allocated as of the last collection of the nursery. */
+	uint64_t m_minorBase;
+	/** Bytes allocated as of the last full collection. */
+	uint64_t m_fullBase;
+	/** Bytes surviving the last full collection. */
+	uint64_t m_fullLive;
+
+	/** Report a pause from \p start, an mps_clock(), until now. */
+	void paused(mps_clock_t start);
+
+    public:
+	GCPacer(const HeapConfig &config, GCTelemetry &telemetry);
+
+	/** Take over pacing of \p arena. */
+	void attach(mps_arena_t arena);
+
+	/**
+	 * Start or advance a collection if one is due. \p bytesAllocated is
+	 * the count of bytes ever allocated.
+	 */
+	void pace(uint64_t bytesAllocated);
+	/**
+	 * Do collection work for up to \p budget seconds, beginning a
+	 * collection of the nursery if it has exceeded its capacity, or of
+	 * the whole heap if the MPS expects that to fit. Returns whether
+	 * there is more to do.
+	 */
+	bool idle(double budget);
+	/** Collect the whole heap now, to completion. */
+	void collect(uint64_t bytesAllocated);
+	/** Note the end of a collection of \p cause. */
+	void collected(GCTelemetry::Cause cause, uint64_t bytesAllocated,
+	    size_t condemned, size_t live);
+
+	/** Size the nursery should reach before it is next collected. */
+	uint64_t nurseryTarget() const;
+	/**
+	 * Whether collection may be left to idle time: the nursery is within
+	 * its largest size and the arena not near its commit limit.
+	 */
+	bool hasHeadroom(uint64_t bytesAllocated) const;
+	/**
+	 * Whether the arena has committed, spare memory aside, 3/4 of its
+	 * commit limit or more.
+	 */
+	bool nearLimit() const;
+
+	inline const HeapConfig &config() const { return m_config; }
+	/** Change the arena's commit limit; returns false if it is in use. */
+	bool setCommitLimit(size_t kb);
+};
+
+#endif /* GCPACER_HH_ */
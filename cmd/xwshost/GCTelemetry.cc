@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstring>
+
+#include "GCTelemetry.hh"
+
+GCTelemetry::GCTelemetry()
+    : m_written(0)
+    , m_nPauses(0)
+    , m_maxPause(0)
+    , m_cause(kOther)
+    , m_startClock(0)
+{
+	memset(m_counters, 0, sizeof(m_counters));
+	memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+void
+GCTelemetry::publish(const GCEvent &event)
+{
+	m_ring[m_written & (kRingSize - 1)] = event;
+	__atomic_store_n(&m_written, m_written + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The MPS's reasons are sentences for people, of which the one for a nursery
+ * collection mentions generation 0 and those for full collections say so.
+ */
+void
+GCTelemetry::recordStart(const char *why, mps_clock_t clock)
+{
+	GCEvent event;
+
+	if (strstr(why, "Generation 0"))
+		m_cause = kMinor;
+	else if (strstr(why, "full collection"))
+		m_cause = kFull;
+	else
+		m_cause = kOther;
+	m_startClock = clock;
+
+	memset(&event, 0, sizeof(event));
+	event.m_kind = GCEvent::kStart;
+	event.m_cause = m_cause;
+	event.m_clock = clock;
+	publish(event);
+}
+
+void
+GCTelemetry::recordFinish(mps_clock_t clock, size_t condemned, size_t live,
+    size_t notCondemned)
+{
+	GCEvent event;
+	Counters &counters = m_counters[m_cause];
+	uint64_t micros = (uint64_t)(clock - m_startClock) * 1000000 /
+	    mps_clocks_per_sec();
+
+	counters.m_collections++;
+	counters.m_condemned += condemned;
+	counters.m_live += live;
+
+	event.m_kind = GCEvent::kFinish;
+	event.m_cause = m_cause;
+	event.m_clock = clock;
+	event.m_condemned = condemned;
+	event.m_live = live;
+	event.m_notCondemned = notCondemned;
+	event.m_micros = micros;
+	publish(event);
+}
+
+void
+GCTelemetry::recordPause(uint64_t micros)
+{
+	int bucket = 0;
+
+	while (bucket < kBuckets - 1 && (micros + 1) >> (bucket + 1))
+		bucket++;
+	m_buckets[bucket]++;
+	m_nPauses++;
+	if (micros > m_maxPause)
+		m_maxPause = micros;
+}
+
+size_t
+GCTelemetry::events(GCEvent *out, size_t max, uint64_t &cursor) const
+{
+	uint64_t written = __atomic_load_n(&m_written, __ATOMIC_ACQUIRE);
+	uint64_t oldest;
+	size_t n = 0;
+
+	if (written >= kRingSize && cursor < written + 1 - kRingSize)
+		cursor = written + 1 - kRingSize;
+	for (; cursor + n < written && n < max; n++)
+		out[n] = m_ring[(cursor + n) & (kRingSize - 1)];
+
+	/*
+	 * Anything the writer has since lapped may be torn, and that includes
+	 * the slot of the event it may be filling in but has yet to count.
+	 */
+	written = __atomic_load_n(&m_written, __ATOMIC_ACQUIRE);
+	oldest = written >= kRingSize ? written + 1 - kRingSize : 0;
+	if (cursor < oldest) {
+		size_t torn = oldest - cursor;
+
+		if (torn >= n)
+			n = 0;
+		else {
+			memmove(out, out + torn, (n - torn) * sizeof(*out));
+			n -= torn;
+		}
+		cursor = oldest;
+	}
+	cursor += n;
+
+	return n;
+}
+
+/*
+ * Answers with the upper bound of the bucket the percentile falls in, or the
+ * maximum if that is less.
+ */
+uint64_t
+GCTelemetry::pausePercentile(double p) const
+{
+	uint64_t rank = (uint64_t)(p * m_nPauses + 0.5), seen = 0;
+
+	if (m_nPauses == 0)
+		return 0;
+	if (rank < 1)
+		rank = 1;
+
+	for (int i = 0; i < kBuckets; i++) {
+		seen += m_buckets[i];
+		if (seen >= rank) {
+			uint64_t bound = ((uint64_t)1 << (i + 1)) - 2;
+			return bound < m_maxPause ? bound : m_maxPause;
+		}
+	}
+	return m_maxPause;
+}
+
+std::string
+GCTelemetry::toJSON() const
+{
+	static const char *names[kNCauses] = { "minor", "full", "other" };
+	std::string json("{");
+	char buf[160];
+
+	for (int i = 0; i < kNCauses; i++) {
+		snprintf(buf, sizeof(buf),
+		    "\"%s\":{\"collections\":%llu,\"condemned\":%llu,"
+		    "\"live\":%llu},",
+		    names[i], (unsigned long long)m_counters[i].m_collections,
+		    (unsigned long long)m_counters[i].m_condemned,
+		    (unsigned long long)m_counters[i].m_live);
+		json += buf;
+	}
+	snprintf(buf, sizeof(buf),
+	    "\"pauseMicros\":{\"count\":%llu,\"p50\":%llu,\"p99\":%llu,"
+	    "\"max\":%llu}}",
+	    (unsigned long long)m_nPauses,
+	    (unsigned long long)pausePercentile(0.5),
+	    (unsigned long long)pausePercentile(0.99),
+	    (unsigned long long)m_maxPause);
+	json += buf;
+
+	return json;
+}
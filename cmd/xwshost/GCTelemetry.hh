@@ -0,0 +1,119 @@
+#ifndef GCTELEMETRY_HH_
+#define GCTELEMETRY_HH_
+
+#include <stdint.h>
+#include <string>
+
+extern "C" {
+#include "mps.h"
+}
+
+/** A collection starting or finishing, as reported by the MPS. */
+struct GCEvent {
+	enum Kind {
+		kStart,
+		kFinish,
+	} m_kind;
+	/** What the collection is; see GCTelemetry::Cause. */
+	int m_cause;
+	/** mps_clock() when the MPS posted it. */
+	mps_clock_t m_clock;
+	/** For kFinish, sizes in bytes. */
+	size_t m_condemned, m_live, m_notCondemned;
+	/**
+	 * For kFinish, microseconds since the start, including the mutator's
+	 * between steps of the collection.
+	 */
+	uint64_t m_micros;
+};
+
+/**
+ * Statistics of the collector, gathered from the MPS's messages as
+ * ObjectMemoryOSThread::poll() takes them.
+ *
+ * Recent events are kept in a ring which other threads may read without
+ * locking: the writer publishes each by bumping a counter after filling it in,
+ * and a reader discards whatever the writer may have overwritten while it was
+ * copying. The counters and histogram are updated only by the writer, and may
+ * be read torn.
+ *
+ * Collections are incremental, so the time from a start to its finish
+ * includes the mutator's; the histogram is instead of pauses, each the time
+ * spent in one call into the collector, as GCPacer reports them.
+ */
+class GCTelemetry {
+    public:
+	/**
+	 * The MPS does not say which generations a collection condemns, only
+	 * why it was started; this is what that amounts to.
+	 */
+	enum Cause {
+		kMinor, /**< the nursery generation reached capacity */
+		kFull,	/**< of the whole heap, as requested or as needed */
+		kOther,
+		kNCauses,
+	};
+
+	struct Counters {
+		uint64_t m_collections;
+		uint64_t m_condemned; /**< bytes, in total */
+		uint64_t m_live;      /**< bytes surviving, in total */
+	};
+
+	/** Capacity of the event ring; a power of two. */
+	static const size_t kRingSize = 256;
+	/**
+	 * Histogram buckets; bucket i counts pauses of [2^i - 1, 2^(i+1) - 1)
+	 * us.
+	 */
+	static const int kBuckets = 40;
+
+	GCTelemetry();
+
+	void recordStart(const char *why, mps_clock_t clock);
+	void recordFinish(mps_clock_t clock, size_t condemned, size_t live,
+	    size_t notCondemned);
+	/** Note a pause of \p micros us for collection work. */
+	void recordPause(uint64_t micros);
+
+	/**
+	 * Copy up to \p max events, beginning with number \p cursor (or the
+	 * oldest still kept, if that is later), into \p out. Returns how many,
+	 * and advances \p cursor past them. Begin with a cursor of 0.
+	 */
+	size_t events(GCEvent *out, size_t max, uint64_t &cursor) const;
+
+	inline const Counters &counters(Cause cause) const
+	{
+		return m_counters[cause];
+	}
+	/**
+	 * Duration of a pause at or below which fraction \p p of all pauses
+	 * fall, in us.
+	 */
+	uint64_t pausePercentile(double p) const;
+	inline uint64_t maxPause() const { return m_maxPause; }
+	/** Of the collection in progress, or else the last. */
+	inline Cause cause() const { return m_cause; }
+
+	/** All but the events, as a JSON object. */
+	std::string toJSON() const;
+
+    private:
+	GCEvent m_ring[kRingSize];
+	/** Events ever written; the next goes at this, masked. */
+	volatile uint64_t m_written;
+
+	Counters m_counters[kNCauses];
+	uint64_t m_buckets[kBuckets];
+	uint64_t m_nPauses;
+	uint64_t m_maxPause;
+
+	/** Of the collection in progress. */
+	Cause m_cause;
+	mps_clock_t m_startClock;
+
+	void publish(const GCEvent &event);
+};
+
+#endif /* GCTELEMETRY_HH_ */
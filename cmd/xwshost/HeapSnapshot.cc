@@ -0,0 +1,248 @@
+#include <cerrno>
+#include <cstdio>
+#include <set>
+
+#include "HeapSnapshot.hh"
+#include "Object.inl.hh"
+
+/*
+ * The snapshot is taken with the arena parked after a full collection, so that
+ * nothing moves while the pools are walked and what is written is (but for
+ * the leeway of ambiguous roots) what is live.
+ */
+
+static const char *const kObjectKinds[] = { "Fwd", "Pad", "EnvironmentMap",
+	"Environment", "PlainArray", "Map", "CharArray", "Function", "Closure",
+	"Activation", "Promise", "NativeFunction", "ArrayBuffer", "WeakRef",
+	"WeakArray", "WeakMap", "FinalizationRegistry" };
+static const char *const kPrimKinds[] = { "String", "Symbol", "Double",
+	"Bytes" };
+
+/** Addresses below this are those of the singletons, not heap objects. */
+static const uintptr_t kMinAddr = 4096;
+
+struct SnapshotWriter {
+	FILE *m_file;
+	mps_fmt_t m_objFmt;
+	/** The WeakArrays allocated weak: the keys of WeakMaps and such. */
+	std::set<ObjectDesc *> m_weakArrays;
+};
+
+static void
+writeRef(FILE *file, Oop oop, bool weak = false)
+{
+	if (oop.isPtr() && oop.addrT<char>() >= (char *)kMinAddr)
+		fprintf(file, weak ? " ~%lx" : " %lx",
+		    (unsigned long)oop.addrT<char>());
+}
+
+template <class S>
+static void
+writeRefs(FILE *file, S *oops, size_t n, bool weak = false)
+{
+	for (size_t i = 0; i < n; i++)
+		writeRef(file, Oop(oops[i]), weak);
+}
+
+/* As in ObjectDesc::mpsScan(). */
+static void
+writeObjectRefs(SnapshotWriter &writer, ObjectDesc *obj)
+{
+	FILE *file = writer.m_file;
+
+	switch (obj->m_kind) {
+	case ObjectDesc::kEnvironmentMap: {
+		EnvironmentMap *map = (EnvironmentMap *)obj;
+
+		writeRefs(file, map->m_names, map->m_nParams + map->m_nLocals);
+		break;
+	}
+
+	case ObjectDesc::kEnvironment: {
+		Environment *env = (Environment *)obj;
+
+		writeRef(file, env->m_prev.get());
+		writeRef(file, env->m_map.get());
+		writeRef(file, env->m_args.get());
+		writeRef(file, env->m_locals.get());
+		break;
+	}
+
+	case ObjectDesc::kPlainArray: {
+		PlainArray *arr = (PlainArray *)obj;
+
+		writeRefs(file, arr->m_elements, arr->m_length);
+		break;
+	}
+
+	case ObjectDesc::kFunction: {
+		Function *fun = (Function *)obj;
+
+		writeRef(file, fun->m_map);
+		writeRef(file, fun->m_handlers);
+		writeRefs(file, fun->m_literals, fun->m_nLiterals);
+		break;
+	}
+
+	case ObjectDesc::kClosure: {
+		Closure *closure = (Closure *)obj;
+
+		writeRef(file, closure->m_func);
+		writeRef(file, closure->m_baseEnv);
+		break;
+	}
+
+	case ObjectDesc::kActivation: {
+		Activation *act = (Activation *)obj;
+
+		writeRef(file, act->m_closure);
+		writeRef(file, act->m_env);
+		writeRef(file, act->m_promise);
+		writeRef(file, act->m_slots);
+		writeRef(file, act->m_result);
+		break;
+	}
+
+	case ObjectDesc::kPromise: {
+		Promise *promise = (Promise *)obj;
+
+		writeRef(file, promise->m_reaction);
+		writeRef(file, promise->m_reactions);
+		writeRef(file, promise->m_result);
+		break;
+	}
+
+	case ObjectDesc::kArrayBuffer:
+		writeRef(file, ((ArrayBuffer *)obj)->m_store);
+		break;
+
+	case ObjectDesc::kWeakRef:
+		writeRef(file, ((WeakRef *)obj)->m_target, true);
+		break;
+
+	case ObjectDesc::kWeakArray: {
+		WeakArray *arr = (WeakArray *)obj;
+
+		writeRefs(file, arr->m_elements, arr->m_length,
+		    writer.m_weakArrays.count(obj) != 0);
+		break;
+	}
+
+	case ObjectDesc::kWeakMap: {
+		WeakMap *map = (WeakMap *)obj;
+
+		writeRef(file, map->m_keys);
+		writeRef(file, map->m_values);
+		break;
+	}
+
+	case ObjectDesc::kFinalizationRegistry: {
+		FinalizationRegistry *reg = (FinalizationRegistry *)obj;
+
+		writeRef(file, reg->m_callback);
+		writeRef(file, reg->m_targets);
+		writeRef(file, reg->m_held);
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+static void
+findWeakArrays(mps_addr_t addr, mps_fmt_t fmt, mps_pool_t pool, void *p,
+    size_t s)
+{
+	SnapshotWriter *writer = (SnapshotWriter *)p;
+	ObjectDesc *obj = (ObjectDesc *)addr;
+	Oop weak;
+
+	if (fmt != writer->m_objFmt)
+		return;
+	else if (obj->m_kind == ObjectDesc::kWeakMap)
+		weak = ((WeakMap *)obj)->m_keys;
+	else if (obj->m_kind == ObjectDesc::kFinalizationRegistry)
+		weak = ((FinalizationRegistry *)obj)->m_targets;
+	else
+		return;
+	writer->m_weakArrays.insert(weak.addrT<ObjectDesc>());
+}
+
+static void
+writeObject(mps_addr_t addr, mps_fmt_t fmt, mps_pool_t pool, void *p,
+    size_t s)
+{
+	SnapshotWriter *writer = (SnapshotWriter *)p;
+	const char *kind;
+	size_t size;
+	int site = 0;
+
+	if (fmt == writer->m_objFmt) {
+		ObjectDesc *obj = (ObjectDesc *)addr;
+
+		if (obj->m_kind == ObjectDesc::kFwd ||
+		    obj->m_kind == ObjectDesc::kPad)
+			return;
+		kind = (size_t)obj->m_kind <
+			sizeof(kObjectKinds) / sizeof(*kObjectKinds) ?
+		    kObjectKinds[obj->m_kind] : "Unknown";
+		size = (char *)ObjectDesc::mpsSkip(addr) - (char *)addr;
+		site = obj->m_bits;
+	} else {
+		PrimDesc *prim = (PrimDesc *)addr;
+
+		if (prim->m_kind >= PrimDesc::kPad16)
+			return;
+		kind = kPrimKinds[prim->m_kind];
+		size = (char *)PrimDesc::mpsSkip(addr) - (char *)addr;
+	}
+
+	fprintf(writer->m_file, "object %lx %s %lu %d", (unsigned long)addr,
+	    kind, (unsigned long)size, site);
+	if (fmt == writer->m_objFmt)
+		writeObjectRefs(*writer, (ObjectDesc *)addr);
+	fputc('\n', writer->m_file);
+}
+
+static void
+writeRoot(mps_addr_t *ref, mps_root_t root, void *p, size_t s)
+{
+	SnapshotWriter *writer = (SnapshotWriter *)p;
+	uintptr_t addr = (uintptr_t)*ref & ~(uintptr_t)15;
+
+	if (addr >= kMinAddr)
+		fprintf(writer->m_file, "root %lx\n", (unsigned long)addr);
+}
+
+bool
+ObjectMemoryOSThread::writeHeapSnapshot(const char *path)
+{
+	mps_arena_t arena = m_omem.arena();
+	SnapshotWriter writer;
+	int err;
+
+	writer.m_file = fopen(path, "w");
+	if (!writer.m_file)
+		return false;
+	writer.m_objFmt = m_omem.m_mpsObjDescFmt;
+
+	collect();
+	/* walking the arena requires it parked */
+	mps_arena_park(arena);
+
+	fprintf(writer.m_file, "%s\n", XWS_SNAPSHOT_MAGIC);
+	for (size_t i = 0; i < m_omem.m_sites.size(); i++)
+		fprintf(writer.m_file, "site %lu %s\n", (unsigned long)i + 1,
+		    m_omem.m_sites[i]->m_name);
+	mps_arena_formatted_objects_walk(arena, findWeakArrays, &writer, 0);
+	mps_arena_formatted_objects_walk(arena, writeObject, &writer, 0);
+	mps_arena_roots_walk(arena, writeRoot, &writer, 0);
+	mps_arena_clamp(arena);
+
+	err = ferror(writer.m_file) ? EIO : 0;
+	if (fclose(writer.m_file) != 0 && !err)
+		err = errno;
+	errno = err;
+	return err == 0;
+}
@@ -0,0 +1,20 @@
+#ifndef HEAPSNAPSHOT_HH_
+#define HEAPSNAPSHOT_HH_
+
+/**
+ * A heap snapshot, as written by ObjectMemoryOSThread::writeHeapSnapshot()
+ * and read by xwsheap, is text, a record to a line:
+ *
+ *	xws-heap-snapshot 1
+ *	site <id> <name>
+ *	object <address> <kind> <size> <site id, or 0> <reference>...
+ *	root <address>
+ *
+ * Addresses are in hex. The first line comes first; the rest may come in any
+ * order. An object's references are the addresses of the heap objects its
+ * fields refer to, those held weakly prefixed with a ~. A site is an
+ * AllocSite; only sampled objects (see AllocSite) are marked with theirs.
+ */
+#define XWS_SNAPSHOT_MAGIC "xws-heap-snapshot 1"
+
+#endif /* HEAPSNAPSHOT_HH_ */
@@ -0,0 +1,185 @@
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "IOUring.hh"
+
+static int
+ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+	    NULL, 0);
+}
+
+IOUring::IOUring()
+    : m_fd(-1)
+    , m_sqes((struct io_uring_sqe *)MAP_FAILED)
+    , m_toSubmit(0)
+    , m_sqRing(MAP_FAILED)
+    , m_cqRing(MAP_FAILED)
+{
+}
+
+IOUring::~IOUring()
+{
+	if (m_sqes != MAP_FAILED)
+		munmap(m_sqes, m_sqesSize);
+	if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+		munmap(m_cqRing, m_cqRingSize);
+	if (m_sqRing != MAP_FAILED)
+		munmap(m_sqRing, m_sqRingSize);
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+/*
+ * Kernels with IORING_FEAT_SINGLE_MMAP (5.4 on) map both rings at once.
+ */
+bool
+IOUring::init(unsigned entries)
+{
+	struct io_uring_params params;
+	char *sq, *cq;
+
+	memset(&params, 0, sizeof(params));
+	m_fd = ioUringSetup(entries, &params);
+	if (m_fd < 0)
+		return false;
+
+	m_sqRingSize = params.sq_off.array + params.sq_entries *
+	    sizeof(unsigned);
+	m_cqRingSize = params.cq_off.cqes + params.cq_entries *
+	    sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (m_cqRingSize > m_sqRingSize)
+			m_sqRingSize = m_cqRingSize;
+		m_cqRingSize = m_sqRingSize;
+	}
+
+	m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+	if (m_sqRing == MAP_FAILED)
+		goto fail;
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		m_cqRing = m_sqRing;
+	else {
+		m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+		if (m_cqRing == MAP_FAILED)
+			goto fail;
+	}
+	m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	m_sqes = (struct io_uring_sqe *)mmap(NULL, m_sqesSize,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+	    IORING_OFF_SQES);
+	if (m_sqes == MAP_FAILED)
+		goto fail;
+
+	sq = (char *)m_sqRing;
+	m_sqHead = (unsigned *)(sq + params.sq_off.head);
+	m_sqTail = (unsigned *)(sq + params.sq_off.tail);
+	m_sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+	m_sqArray = (unsigned *)(sq + params.sq_off.array);
+
+	cq = (char *)m_cqRing;
+	m_cqHead = (unsigned *)(cq + params.cq_off.head);
+	m_cqTail = (unsigned *)(cq + params.cq_off.tail);
+	m_cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+	m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return true;
+
+fail:
+	close(m_fd);
+	m_fd = -1;
+	return false;
+}
+
+struct io_uring_sqe *
+IOUring::getSqe()
+{
+	unsigned tail = *m_sqTail;
+	unsigned idx;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) > *m_sqMask)
+		return NULL;
+
+	idx = tail & *m_sqMask;
+	sqe = &m_sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	m_sqArray[idx] = idx;
+	__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+	m_toSubmit++;
+
+	return sqe;
+}
+
+bool
+IOUring::submit()
+{
+	while (m_toSubmit > 0) {
+		int res = ioUringEnter(m_fd, m_toSubmit, 0, 0);
+
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res < 0)
+			return false;
+		m_toSubmit -= res;
+	}
+	return true;
+}
+
+bool
+IOUring::reap(struct io_uring_cqe &cqe)
+{
+	unsigned head = *m_cqHead;
+
+	if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+		return false;
+
+	cqe = m_cqes[head & *m_cqMask];
+	__atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+bool
+IOUring::cancel(uint64_t userData)
+{
+	struct io_uring_sqe *sqe = getSqe();
+
+	if (!sqe && submit())
+		sqe = getSqe();
+	if (!sqe)
+		return false;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = userData;
+	sqe->user_data = kCancelTag;
+
+	return true;
+}
+
+bool
+IOUring::wait()
+{
+	for (;;) {
+		int res = ioUringEnter(m_fd, m_toSubmit, 1,
+		    IORING_ENTER_GETEVENTS);
+
+		if (res >= 0) {
+			m_toSubmit -= res;
+			return true;
+		} else if (errno != EINTR)
+			return false;
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef IOURING_HH_
+#define IOURING_HH_
+
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+/**
+ * A minimal io_uring, driven through the raw system calls so as not to need
+ * liburing. Submissions are batched: they are only passed to the kernel by
+ * submit(), which the event loop calls once per poll.
+ */
+class IOUring {
+	int m_fd;
+	/** Submission queue ring, shared with the kernel. */
+	unsigned *m_sqHead, *m_sqTail, *m_sqMask, *m_sqArray;
+	struct io_uring_sqe *m_sqes;
+	/** Completion queue ring, shared with the kernel. */
+	unsigned *m_cqHead, *m_cqTail, *m_cqMask;
+	struct io_uring_cqe *m_cqes;
+	/** Entries queued since the last submit(). */
+	unsigned m_toSubmit;
+
+	void *m_sqRing, *m_cqRing;
+	size_t m_sqRingSize, m_cqRingSize, m_sqesSize;
+
+    public:
+	/** user_data of the entries queued by cancel(). */
+	static const uint64_t kCancelTag = ~(uint64_t)0;
+
+	IOUring();
+	~IOUring();
+
+	/**
+	 * Set up a ring of \p entries entries. Returns false if io_uring is
+	 * unavailable, as on old kernels or where it is disallowed.
+	 */
+	bool init(unsigned entries);
+	inline bool ok() const { return m_fd >= 0; }
+	/** The ring's descriptor, readable when there are completions. */
+	inline int fd() const { return m_fd; }
+
+	/**
+	 * A zeroed submission queue entry to fill in, or NULL if the queue is
+	 * full; it is queued for the next submit().
+	 */
+	struct io_uring_sqe *getSqe();
+	/** Pass queued entries to the kernel. Returns false on error. */
+	bool submit();
+	/** Take the next completion, if any, into \p cqe. */
+	bool reap(struct io_uring_cqe &cqe);
+	/**
+	 * Queue the cancellation of the entry with user_data \p userData.
+	 * Returns false if the queue is full even after a submit().
+	 */
+	bool cancel(uint64_t userData);
+	/** Submit, then wait for a completion. Returns false on error. */
+	bool wait();
+};
+
+#endif /* IOURING_HH_ */
@@ -4,8 +4,11 @@
 #include <limits>
 #include <math.h>
 #include <stdint.h>
+#include <string>
+#include <time.h>
 
 #include "Bytecode.hh"
+#include "EventLoop.hh"
 #include "ObjectMemory.hh"
 #include "VM.hh"
 #include "Object.inl.hh"
@@ -25,6 +28,40 @@ namespace VM {
 static const int gSmiMax = INT32_MAX / 2, gSmiMin = INT32_MIN / 2;
 static const double gEpsilon = std::numeric_limits<double>::epsilon();
 
+/*
+ * Allocation sites, for pretenuring; see AllocSite. There is one for each kind
+ * of object the interpreter makes, not one for each place in the script.
+ */
+static AllocSite s_envSite("environment"), s_actSite("activation"),
+    s_promiseSite("promise"), s_closureSite("closure");
+
+#define AS(T, VAL) (*(T*)&(VAL))
+
+/* Is \p val a heap object of kind \p kind? */
+static inline bool
+isKind(Oop val, ObjectDesc::Kind kind)
+{
+	return val.tag() == Oop::kObject &&
+	    val.addrT<ObjectDesc>()->m_kind == kind;
+}
+
+/* Is \p val an Activation of a function of type \p type? */
+static inline bool
+isActivation(Oop val, Function::Type type)
+{
+	return isKind(val, ObjectDesc::kActivation) &&
+	    val.addrT<Activation>()->m_closure->m_func->m_type == type;
+}
+
+static uint64_t
+monotonicMillis()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 inline Oop
 Interpreter::push(Oop oop)
 {
@@ -40,20 +77,584 @@ Interpreter::pop()
 	return val;
 }
 
+inline void
+Interpreter::countHotness(int32_t loopHeader)
+{
+	MemOop<Function> fun = m_closure->m_func;
+
+	if (++fun->m_hotness == kTierUpThreshold)
+		tierUp(fun, loopHeader);
+}
+
+/*
+ * Called once when a function crosses the tier-up threshold. If it became hot
+ * on a back edge, \p loopHeader is the bytecode offset of the loop header:
+ * that is the on-stack replacement entry point, where an optimised body would
+ * take over the live frame (the operand stack above m_bp, and m_env) mid-loop,
+ * handing it back to the interpreter on deoptimisation.
+ *
+ * There is no optimising tier yet, so the entry point is only recorded.
+ */
+void
+Interpreter::tierUp(MemOop<Function> fun, int32_t loopHeader)
+{
+	fun->m_osrEntry = loopHeader;
+}
+
+inline void
+Interpreter::safepoint(int32_t cost)
+{
+	if ((m_safepointTicks -= cost) <= 0)
+		handleSafepoint();
+}
+
+void
+Interpreter::handleSafepoint()
+{
+	int32_t ticks = m_safepointTicks;
+	uint32_t interrupts;
+
+	if (ticks < -kInterruptBias / 2)
+		ticks += kInterruptBias;
+	m_instructions += m_safepointQuantum - ticks;
+	m_omemt.poll();
+	checkLimits();
+
+	interrupts = __sync_fetch_and_and(&m_interrupts, 0);
+	if (interrupts == 0)
+		return;
+
+	if (interrupts & kInterruptGC)
+		m_omemt.collect();
+	if (interrupts & kInterruptSample)
+		sampleStack();
+	if (interrupts & kInterruptTerminate)
+		throw Termination(Termination::kRequested,
+		    "terminated on request");
+}
+
+/*
+ * Also resets the tick counter: to the safepoint interval, or to what remains
+ * of the instruction budget if that is less, so the budget is not overrun by
+ * more than the cost of a single safepoint.
+ */
+void
+Interpreter::checkLimits()
+{
+	int32_t quantum = kSafepointInterval;
+
+	if (m_limits.m_maxInstructions) {
+		if (m_instructions >= m_limits.m_maxInstructions)
+			throw Termination(Termination::kInstructionBudget,
+			    "instruction budget exhausted");
+		if (m_limits.m_maxInstructions - m_instructions <
+		    (uint64_t)quantum)
+			quantum = m_limits.m_maxInstructions - m_instructions;
+	}
+
+	if (m_limits.m_maxBytesAllocated &&
+	    m_omemt.bytesAllocated() - m_bytesAllocatedBase >
+		m_limits.m_maxBytesAllocated)
+		throw Termination(Termination::kHeapBudget,
+		    "allocation budget exhausted");
+
+	if (m_deadline && monotonicMillis() >= m_deadline)
+		throw Termination(Termination::kDeadline, "deadline passed");
+
+	m_safepointQuantum = m_safepointTicks = quantum;
+}
+
+/*
+ * Frames are linked through the stack: a call pushes the caller's pc, bp,
+ * closure and environment, and bp then indexes the environment slot. The
+ * outermost frame has a bp of 0.
+ */
+inline unsigned int
+Interpreter::frameBase() const
+{
+	return m_bp ? m_bp + 1 : 0;
+}
+
+inline void
+Interpreter::setClosure(MemOop<Closure> closure)
+{
+	m_closure = closure;
+	m_code = closure->m_code;
+	m_literals = closure->m_func->m_literals;
+}
+
+/*
+ * It is made in the code space, to live as long as the function, over the
+ * global environment: the root of every chain, and the only one in which the
+ * function's names may be bound.
+ */
+MemOop<Closure>
+Interpreter::makeStaticClosure(MemOop<Function> fun)
+{
+	CodeScope code(m_omemt);
+	MemOop<Environment> env = m_env;
+
+	while (!env->m_prev.get().isUndefined())
+		env = env->m_prev;
+
+	return m_omemt.makeClosure(fun, env);
+}
+
+void
+Interpreter::pushFrame(MemOop<Closure> closure, MemOop<Environment> env)
+{
+	push((int32_t)m_pc);
+	push((int32_t)m_bp);
+	push(m_closure);
+	push(m_env);
+
+	m_pc = 0;
+	m_bp = m_stack.size() - 1;
+	setClosure(closure);
+	m_env = env;
+}
+
+void
+Interpreter::popFrame()
+{
+	m_stack.resize(m_bp + 1);
+	Oop env = pop();
+	Oop closure = pop();
+	m_env = AS(MemOop<Environment>, env);
+	setClosure(AS(MemOop<Closure>, closure));
+	m_bp = pop().asI32();
+	m_pc = pop().asI32();
+}
+
+/*
+ * A native function is run then and there, on the arguments where they lie on
+ * the stack. Calling a generator makes its activation, and calling an async
+ * function makes its activation and promise and runs it until it awaits.
+ */
+bool
+Interpreter::call(Oop callee, uint8_t nArgs)
+{
+	if (isKind(callee, ObjectDesc::kNativeFunction)) {
+		NativeFunction *native = callee.addrT<NativeFunction>();
+		size_t base = m_stack.size() - nArgs;
+		Oop res = native->m_fn(*this, native->m_data,
+		    nArgs ? &m_stack[base] : NULL, nArgs);
+
+		m_stack.resize(base);
+		if (m_nativeThrew) {
+			m_nativeThrew = false;
+			return throwValue(res);
+		}
+		push(res);
+		return true;
+	}
+
+	if (!isKind(callee, ObjectDesc::kClosure))
+		return throwError("TypeError: not a function", "");
+
+	HandleScope scope(m_omemt);
+	Handle<Closure> closure(m_omemt, callee);
+	Handle<Environment> env(m_omemt, m_omemt.makeEnvironment(
+	    closure->m_baseEnv, closure->m_func->m_map, nArgs, &s_envSite));
+
+	for (int i = 0; i < nArgs; i++) {
+		Oop arg = pop();
+#ifdef XWS_DEBUG
+		printf("ARG %d:", i);
+		arg.print();
+		printf("\n");
+#endif
+
+		env->m_args->m_elements[i] = arg;
+	}
+
+	if (closure->m_func->m_type != Function::kPlain) {
+		Handle<Activation> act(m_omemt,
+		    m_omemt.makeActivation(closure, env, &s_actSite));
+		MemOop<Promise> promise;
+
+		if (closure->m_func->m_type == Function::kGenerator) {
+			push(*act);
+			return true;
+		}
+
+		promise = m_omemt.makePromise(&s_promiseSite);
+		act->m_promise = promise;
+		push(promise);
+		resume(act, ObjectMemory::s_undefined);
+		return true;
+	}
+
+	pushFrame(closure, env);
+	countHotness(-1);
+	safepoint(closure->m_func->m_length);
+
+	return true;
+}
+
+/*
+ * Nothing is done on entry to a try block, so this is where all the work of
+ * exception handling happens: the current function's handler table is
+ * searched for the innermost range covering the throwing instruction, and if
+ * there is none the frame is popped and the caller's table searched in turn.
+ */
+bool
+Interpreter::throwValue(Oop exc)
+{
+	for (;;) {
+		MemOop<PlainArray> handlers = m_closure->m_func->m_handlers;
+		int32_t pc = m_pc - 1;
+		/* once draining, the top level is only a place to return to */
+		size_t nHandlers = m_draining && m_bp == 0 ? 0 :
+		    handlers->m_length;
+
+		for (size_t i = 0; i < nHandlers; i += 4) {
+			OopSlot<> *entry = &handlers->m_elements[i];
+
+			if (pc < entry[0].get().asI32() ||
+			    pc >= entry[1].get().asI32())
+				continue;
+
+			m_stack.resize(frameBase() + entry[3].get().asI32());
+			push(exc);
+			m_pc = entry[2].get().asI32();
+			return true;
+		}
+
+		if (m_bp == 0) {
+			printf("Uncaught exception:\n");
+			exc.print();
+			printf("\n");
+			if (m_draining) {
+				/* only the microtask is abandoned */
+				m_stack.resize(1);
+				return true;
+			}
+			m_stack.clear();
+			return false;
+		}
+
+		/*
+		 * A generator's exception propagates to whoever resumed it;
+		 * an async function's rejects its promise.
+		 */
+		Function::Type type = m_closure->m_func->m_type;
+		MemOop<Activation> act;
+
+		if (type != Function::kPlain) {
+			act = AS(MemOop<Activation>, m_stack[frameBase()]);
+			act->m_state = Activation::kFailed;
+			act->m_result = exc;
+		}
+
+		popFrame();
+
+		if (type == Function::kAsync) {
+			settle(act->m_promise, Promise::kRejected, exc);
+			return true;
+		}
+	}
+}
+
+bool
+Interpreter::throwError(const char *msg, const char *detail)
+{
+	std::string txt(msg);
+
+	txt += detail;
+	return throwValue(m_omemt.makeString(txt.c_str()));
+}
+
+/*
+ * Resuming a suspended frame costs no allocation: the frame is pushed as if
+ * for a call, followed by the saved operand stack slots.
+ */
+void
+Interpreter::resume(MemOop<Activation> act, Oop sent)
+{
+	pushFrame(act->m_closure, act->m_env);
+	m_pc = act->m_pc;
+
+	push(act);
+	for (uint32_t i = 0; i < act->m_nSlots; i++)
+		push(act->m_slots->m_elements[i]);
+	if (act->m_state == Activation::kSuspended)
+		push(sent);
+	act->m_state = Activation::kRunning;
+}
+
+/*
+ * The slots array is only allocated when a suspension has more live slots
+ * than any before it, so usually not at all.
+ */
+MemOop<Activation>
+Interpreter::suspend()
+{
+	unsigned int base = frameBase();
+	MemOop<Activation> act = AS(MemOop<Activation>, m_stack[base]);
+	uint32_t nSlots = m_stack.size() - base - 1;
+
+	if (nSlots > 0 && (act->m_slots.tag() != Oop::kObject ||
+	    act->m_slots->m_length < nSlots)) {
+		MemOop<PlainArray> slots = m_omemt.makeArray(nSlots);
+
+		/* it is still in the frame, which is rooted */
+		act = AS(MemOop<Activation>, m_stack[base]);
+		act->m_slots = slots;
+	}
+	for (uint32_t i = 0; i < nSlots; i++)
+		act->m_slots->m_elements[i] = m_stack[base + 1 + i];
+	act->m_nSlots = nSlots;
+	act->m_pc = m_pc;
+	act->m_state = Activation::kSuspended;
+	popFrame();
+
+	return act;
+}
+
+void
+Interpreter::finish(Oop val)
+{
+	Function::Type type = m_closure->m_func->m_type;
+	MemOop<Activation> act = AS(MemOop<Activation>, m_stack[frameBase()]);
+
+	act->m_state = Activation::kDone;
+	act->m_result = val;
+	popFrame();
+
+	if (type == Function::kGenerator) {
+		push(val);
+		push(ObjectMemory::s_false);
+	} else
+		settle(act->m_promise, Promise::kFulfilled, val);
+}
+
+void
+Interpreter::settle(MemOop<Promise> promise, Promise::State state, Oop val)
+{
+	if (promise->m_state != Promise::kPending)
+		return;
+
+	if (state == Promise::kFulfilled && val.m_full == promise.m_full) {
+		HandleScope scope(m_omemt);
+		Handle<Promise> hPromise(m_omemt, promise);
+
+		state = Promise::kRejected;
+		val = m_omemt.makeString(
+		    "TypeError: promise resolved with itself");
+		promise = hPromise;
+	} else if (state == Promise::kFulfilled &&
+	    isKind(val, ObjectDesc::kPromise)) {
+		MemOop<Promise> on = AS(MemOop<Promise>, val);
+
+		if (on->m_state == Promise::kPending) {
+			addReaction(on, promise);
+			return;
+		}
+		state = on->m_state;
+		val = on->m_result;
+	}
+
+	promise->m_state = state;
+	promise->m_result = val;
+
+	if (!promise->m_reaction.isUndefined())
+		enqueueMicrotask(promise->m_reaction, promise);
+	for (uint32_t i = 0; i < promise->m_nReactions; i++)
+		enqueueMicrotask(promise->m_reactions->m_elements[i], promise);
+	promise->m_reaction = ObjectMemory::s_undefined;
+	promise->m_reactions = AS(MemOop<PlainArray>, ObjectMemory::s_undefined);
+	promise->m_nReactions = 0;
+}
+
+void
+Interpreter::addReaction(MemOop<Promise> promise, Oop target)
+{
+	if (promise->m_reaction.isUndefined()) {
+		promise->m_reaction = target;
+		return;
+	}
+
+	if (promise->m_reactions.isUndefined() ||
+	    promise->m_nReactions == promise->m_reactions->m_length) {
+		HandleScope scope(m_omemt);
+		Handle<Promise> hPromise(m_omemt, promise);
+		Handle<> hTarget(m_omemt, target);
+		MemOop<PlainArray> reactions = m_omemt.makeArray(
+		    promise->m_nReactions ? promise->m_nReactions * 2 : 2);
+
+		promise = hPromise;
+		target = *hTarget;
+		for (uint32_t i = 0; i < promise->m_nReactions; i++)
+			reactions->m_elements[i] =
+			    promise->m_reactions->m_elements[i];
+		promise->m_reactions = reactions;
+	}
+	promise->m_reactions->m_elements[promise->m_nReactions++] = target;
+}
+
+void
+Interpreter::enqueueMicrotask(Oop target, Oop arg)
+{
+	size_t size = m_microtasks.size();
+
+	if (m_mtTail - m_mtHead == size) {
+		std::vector<Oop> grown(size * 2, ObjectMemory::s_undefined);
+
+		for (size_t i = 0; i < size; i++)
+			grown[i] = m_microtasks[(m_mtHead + i) & (size - 1)];
+		m_microtasks.swap(grown);
+		m_mtBatchEnd -= m_mtHead;
+		m_mtTail -= m_mtHead;
+		m_mtHead = 0;
+		size *= 2;
+	}
+
+	m_microtasks[m_mtTail++ & (size - 1)] = target;
+	m_microtasks[m_mtTail++ & (size - 1)] = arg;
+}
+
+/*
+ * Microtasks run in batches, a batch being those queued when it starts. Between
+ * batches the interpreter passes a safepoint, so GC messages are drained and
+ * budgets checked, and polls the event loop for due timers; so neither is
+ * starved by a script which keeps queueing microtasks. Once there are none
+ * left, the event loop is waited upon.
+ *
+ * A microtask runs in a frame returning to the top-level Return, which starts
+ * the next.
+ */
+bool
+Interpreter::runMicrotask()
+{
+	while (m_mtHead == m_mtBatchEnd) {
+		bool idle = m_mtHead == m_mtTail;
+
+		handleSafepoint();
+		if (!(m_loop && m_loop->poll(*this, idle)) && idle)
+			return false;
+		m_mtBatchEnd = m_mtTail;
+	}
+
+	size_t mask = m_microtasks.size() - 1;
+	Oop target = m_microtasks[m_mtHead & mask];
+	Oop arg = m_microtasks[(m_mtHead + 1) & mask];
+	Promise::State state = Promise::kFulfilled;
+
+	m_microtasks[m_mtHead++ & mask] = ObjectMemory::s_undefined;
+	m_microtasks[m_mtHead++ & mask] = ObjectMemory::s_undefined;
+
+	if (isKind(arg, ObjectDesc::kPromise)) {
+		state = arg.addrT<Promise>()->m_state;
+		arg = arg.addrT<Promise>()->m_result;
+	}
+
+	if (isKind(target, ObjectDesc::kActivation)) {
+		resume(AS(MemOop<Activation>, target), arg);
+		if (state == Promise::kRejected)
+			throwValue(arg);
+		return true;
+	} else if (isKind(target, ObjectDesc::kPromise)) {
+		settle(AS(MemOop<Promise>, target), state, arg);
+		return true;
+	}
+
+	push(arg);
+	call(target, 1);
+	return true;
+}
+
+void
+Interpreter::sampleStack()
+{
+	MemOop<Closure> closure = m_closure;
+	unsigned int pc = m_pc, bp = m_bp;
+
+	printf("Stack sample:\n");
+	for (;;) {
+		printf("  function %p, pc %u\n",
+		    closure->m_func.addrT<void>(), pc);
+		if (bp == 0)
+			break;
+		closure = AS(MemOop<Closure>, m_stack[bp - 1]);
+		pc = m_stack[bp - 3].asI32();
+		bp = m_stack[bp - 2].asI32();
+	}
+}
+
+/*
+ * The interpreter only reads the interrupt word once its tick counter runs
+ * out, so alongside setting the bit we drive the counter below zero. It is
+ * biased rather than zeroed so that handleSafepoint() can still tell how many
+ * ticks were used, and only once, so that repeated requests cannot overflow
+ * it. The bias races with the interpreter's own decrement and may be lost, in
+ * which case the request is seen at the latest kSafepointInterval safepoints
+ * later.
+ */
+void
+Interpreter::requestInterrupt(Interrupt what)
+{
+	int32_t ticks;
+
+	__sync_fetch_and_or(&m_interrupts, what);
+	do {
+		ticks = m_safepointTicks;
+		if (ticks < -kInterruptBias / 2)
+			break;
+	} while (!__sync_bool_compare_and_swap(&m_safepointTicks, ticks,
+	    ticks - kInterruptBias));
+	if (m_loop)
+		m_loop->wake();
+}
+
+void
+Interpreter::setEventLoop(EventLoop *loop)
+{
+	m_loop = loop;
+}
+
+void
+Interpreter::setLimits(const ResourceLimits &limits)
+{
+	m_limits = limits;
+}
+
 Interpreter::Interpreter(ObjectMemoryOSThread &omemt, MemOop<Closure> closure)
     : m_omemt(omemt)
 {
 	m_bp = 0;
 	m_pc = 0;
-	m_closure = closure;
-	m_env = omemt.makeEnvironment(
-	    *(MemOop<Environment> *)&ObjectMemory::s_undefined,
-	    closure->m_func->m_map, 0);
+	m_safepointQuantum = m_safepointTicks = kSafepointInterval;
+	m_interrupts = 0;
+	m_microtasks.resize(kMicrotasksInitial, ObjectMemory::s_undefined);
+	m_mtHead = m_mtTail = m_mtBatchEnd = 0;
+	m_loop = NULL;
+	m_nativeThrew = false;
+	m_draining = false;
+	setClosure(closure);
+	m_script = closure;
+	m_env = AS(MemOop<Environment>, ObjectMemory::s_undefined);
+	m_scriptEnv = m_env;
+	m_heapError = ObjectMemory::s_undefined;
 
 	mps_root_create(&m_mpsRoot, omemt.omem().arena(), mps_rank_exact(),
 	    MPS_RM_PROT, scanOopVec, &m_stack, 0);
+	mps_root_create_area(&m_mpsRegsRoot, omemt.omem().arena(),
+	    mps_rank_exact(), 0, &m_env, &m_heapError + 1, scanOopArea, NULL);
+	mps_root_create(&m_mpsMicrotasksRoot, omemt.omem().arena(),
+	    mps_rank_exact(), MPS_RM_PROT, scanOopVec, &m_microtasks, 0);
+
+	m_env = omemt.makeEnvironment(m_closure->m_baseEnv,
+	    m_closure->m_func->m_map, 0);
+	m_scriptEnv = m_env;
+	m_heapError = omemt.makeString("RangeError: out of memory");
+}
 
-	printf("Hello\n");
+Interpreter::~Interpreter()
+{
+	mps_root_destroy(m_mpsMicrotasksRoot);
+	mps_root_destroy(m_mpsRegsRoot);
+	mps_root_destroy(m_mpsRoot);
 }
 
 #define ISINT32(x) a.type == JSValue::kInt32
@@ -63,12 +664,58 @@ Interpreter::Interpreter(ObjectMemoryOSThread &omemt, MemOop<Closure> closure)
 
 void
 Interpreter::interpret()
+{
+	m_instructions = 0;
+	m_bytesAllocatedBase = m_omemt.bytesAllocated();
+	m_deadline = m_limits.m_maxMillis ?
+	    monotonicMillis() + m_limits.m_maxMillis : 0;
+
+	try {
+		checkLimits();
+		runGuarded();
+	} catch (Termination &) {
+		m_stack.clear();
+		m_bp = 0;
+		m_pc = 0;
+		setClosure(m_script);
+		m_env = m_scriptEnv;
+		m_microtasks.assign(m_microtasks.size(),
+		    ObjectMemory::s_undefined);
+		m_mtHead = m_mtTail = m_mtBatchEnd = 0;
+		m_draining = false;
+		throw;
+	}
+}
+
+/*
+ * The instruction whose allocation failed is abandoned as if it had thrown;
+ * the handler's stack depth discards whatever it had left on the stack.
+ */
+void
+Interpreter::runGuarded()
+{
+	for (;;) {
+		try {
+			run();
+			return;
+		} catch (HeapExhausted &exc) {
+			if (exc.m_terminate)
+				throw Termination(Termination::kHeapLimit,
+				    "heap limit reached");
+			if (!throwValue(m_heapError))
+				return;
+		}
+	}
+}
+
+void
+Interpreter::run()
 {
 	while (1) {
-#define FETCH m_closure->m_func->m_bytecode->m_elements[m_pc++]
+#define FETCH m_code[m_pc++]
 		char op = FETCH;
 
-		printf("about to execute %s\n", opName((VM::Op)op));
+		xwsDbg("about to execute %s\n", opName((VM::Op)op));
 
 		switch (op) {
 		case kPushArg: {
@@ -84,23 +731,34 @@ Interpreter::interpret()
 
 		case kPushLiteral: {
 			uint8_t idx = FETCH;
-			push(m_closure->m_func->m_literals->m_elements[idx]);
+			push(m_literals[idx]);
 			break;
 		}
 
 		case kResolve: {
 			uint8_t idx = FETCH;
-			PrimOop val = *(PrimOop*)&m_closure->m_func->m_literals->m_elements[idx];
-			push(m_env->lookup(val->m_str));
+			PrimOop val = AS(OopSlot<PrimOop>, m_literals[idx]);
+			OopSlot<> *ref = m_env->lookup(val->m_str);
+
+			if (ref)
+				push(*ref);
+			else if (!throwError("ReferenceError: not defined: ",
+				     val->m_str))
+				return;
 			break;
 		}
 
 		case kResolvedStore: {
 			uint8_t idx = FETCH;
-			PrimOop id = *(PrimOop*)&m_closure->m_func->m_literals->m_elements[idx];
+			PrimOop id = AS(OopSlot<PrimOop>, m_literals[idx]);
 			Oop obj = m_stack.back();
+			OopSlot<> *ref = m_env->lookup(id->m_str);
 
-			m_env->lookup(id->m_str) = obj;
+			if (ref)
+				*ref = obj;
+			else if (!throwError("ReferenceError: not defined: ",
+				     id->m_str))
+				return;
 
 			break;
 		}
@@ -129,6 +787,31 @@ Interpreter::interpret()
 			break;
 		}
 
+		case kLoop: {
+			uint8_t b1 = FETCH;
+			uint8_t b2 = FETCH;
+			int16_t offs = (b1 << 8) | b2;
+
+			m_pc += offs;
+			countHotness(m_pc);
+			safepoint(-offs);
+			break;
+		}
+
+		case kLoopIfTrue: {
+			uint8_t b1 = FETCH;
+			uint8_t b2 = FETCH;
+			int16_t offs = (b1 << 8) | b2;
+			Oop val = pop();
+
+			if (val.JS_ToBoolean()) {
+				m_pc += offs;
+				countHotness(m_pc);
+				safepoint(-offs);
+			}
+			break;
+		}
+
 		case kAdd: {
 			Oop a = pop();
 			Oop b = pop();
@@ -141,8 +824,9 @@ Interpreter::interpret()
 					push((int32_t)res);
 			} else if (a.type() == Oop::kDouble && b.type() == Oop::kDouble)
 			{
-				*a.dblAddr() = *a.dblAddr() + *b.dblAddr();
-				push(a);
+				/* operands may be literals; never update in place */
+				push(m_omemt.makeDouble(*b.dblAddr() +
+				    *a.dblAddr()));
 			}
 			else
 				abort();
@@ -220,33 +904,25 @@ Interpreter::interpret()
 		};
 #endif
 
-#define AS(T, VAL) (*(T*)&(VAL))
-
 		case kCall: {
 			uint8_t nArgs = FETCH;
 			Oop val = pop();
-			MemOop<Closure> closure = AS(MemOop<Closure>, val);
-			MemOop<Environment> env = m_omemt.makeEnvironment(m_env, closure->m_func->m_map, nArgs);
 
-			for (int i = 0; i < nArgs; i++) {
-				printf("ARG %d:", i);
-				Oop arg = pop();
-				arg.print();
-				printf("\n");
-
-				env->m_args->m_elements[i] = arg;
-			}
-
-			push((int32_t)m_pc);
-			push((int32_t)m_bp);
-			push(m_closure);
-			push(m_env);
+			if (!call(val, nArgs))
+				return;
+			break;
+		}
 
-			m_pc = 0;
-			m_bp = m_stack.size() - 1;
-			m_closure = closure;
-			m_env = env;
+		case kPushStaticClosure: {
+			uint8_t idx = FETCH;
+			Oop lit = m_literals[idx];
 
+			if (isKind(lit, ObjectDesc::kFunction)) {
+				lit = makeStaticClosure(AS(MemOop<Function>,
+				    lit));
+				m_literals[idx] = lit;
+			}
+			push(lit);
 			break;
 		}
 
@@ -255,7 +931,8 @@ Interpreter::interpret()
 			MemOop<Function> val = AS(MemOop<Function>, VAL);
 			MemOop<Closure> closure;
 
-			closure = m_omemt.makeClosure(val, m_env);
+			closure = m_omemt.makeClosure(val, m_env,
+			    &s_closureSite);
 			push(closure);
 
 			break;
@@ -264,40 +941,107 @@ Interpreter::interpret()
 
 		case kReturn:
 		{
-			Oop val = pop();
+			if (m_bp == 0) {
+				/*
+				 * The script's value stays at the bottom of
+				 * the stack while microtasks run, each one
+				 * returning here; what they leave is dropped.
+				 */
+				if (!m_draining) {
+					Oop val = pop();
+
+					m_stack.clear();
+					push(val);
+					m_draining = true;
+				} else
+					m_stack.resize(1);
+				m_pc--;
+
+				if (runMicrotask())
+					break;
 
-			if (m_stack.empty()) {
+				m_draining = false;
+#ifdef XWS_DEBUG
 				printf(
 				    "Interpretation finished with a final value of:\n");
-				val.print();
+				pop().print();
 				printf("\n");
+#else
+				pop();
+#endif
 				return;
-			} else {
-				/*JSValue env = pop();
-				JSValue closure = pop();
-				JSValue bp = pop();
-				JSValue pc = pop();*/
-
-				printf("RETURNING...\n");
-				mps_arena_collect(m_omemt.omem().arena());
-				Oop env = pop();
-				Oop closure = pop();
-				m_env = AS(MemOop<Environment>, env);
-				m_closure = AS(MemOop<Closure>, closure);
-				m_bp = pop().asI32();
-				m_pc = pop().asI32();
-				//assert(m_env);
-				//assert(m_closure);
+			}
+
+			Oop val = pop();
+
+			if (m_closure->m_func->m_type != Function::kPlain)
+				finish(val);
+			else {
+				xwsDbg("RETURNING...\n");
+				popFrame();
 				push(val);
 			}
 			break;
 		}
 
+		case kThrow: {
+			Oop val = pop();
+
+			if (!throwValue(val))
+				return;
+			break;
+		}
+
+		case kYield: {
+			HandleScope scope(m_omemt);
+			Handle<> val(m_omemt, pop());
+
+			suspend();
+			push(*val);
+			push(ObjectMemory::s_true);
+			break;
+		}
+
+		case kAwait: {
+			HandleScope scope(m_omemt);
+			Handle<> hVal(m_omemt, pop());
+			MemOop<Activation> act = suspend();
+			Oop val = *hVal;
+
+			if (isKind(val, ObjectDesc::kPromise) &&
+			    val.addrT<Promise>()->m_state == Promise::kPending)
+				addReaction(AS(MemOop<Promise>, val), act);
+			else
+				enqueueMicrotask(act, val);
+			break;
+		}
+
+		case kIterate: {
+			Oop val = m_stack.back();
+
+			if (!isActivation(val, Function::kGenerator)) {
+				if (!throwError("TypeError: not iterable", ""))
+					return;
+				break;
+			}
+
+			MemOop<Activation> act = AS(MemOop<Activation>, val);
+
+			if (act->m_state == Activation::kRunning) {
+				if (!throwError("TypeError: generator is running",
+					""))
+					return;
+			} else if (act->m_state >= Activation::kDone) {
+				push(ObjectMemory::s_undefined);
+				push(ObjectMemory::s_false);
+			} else
+				resume(act, ObjectMemory::s_undefined);
+			break;
+		}
+
 		default:
 			abort();
 		}
-
-		m_omemt.poll();
 	}
 }
 
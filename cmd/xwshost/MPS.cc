@@ -1,7 +1,9 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <err.h>
+#include <sys/mman.h>
 
 #include "Object.h"
 
@@ -9,43 +11,125 @@
 
 extern "C" {
 #include "mps.h"
+#include "mpsacl.h"
 #include "mpsavm.h"
 #include "mpscamc.h"
+#include "mpscams.h"
+#include "mpscawl.h"
+#include "mpsclo.h"
 #include "mpstd.h" /* for MPS_BUILD_MV */
 }
 
-#define gcDbg(...) printf(__VA_ARGS__)
 #define FATAL(...) errx(EXIT_FAILURE, __VA_ARGS__)
-#define LENGTH(array) (sizeof(array) / sizeof(array[0]))
 
 mps_arena_t ObjectMemory::m_mpsArena = NULL;
 
-static mps_res_t scanArea(mps_ss_t ss, void *base, void *limit, void *closure);
+#ifdef XWS_COMPRESSED_OOPS
+uintptr_t OopCage::s_base = 0;
 
-ObjectMemory::ObjectMemory()
+/*
+ * Reserve the cage: address space for three cages is reserved, one aligned
+ * within it is kept (skipping any whose base would read as a Smi's high word),
+ * and \p size bytes at its start are made accessible. The MPS is given all
+ * but the guard as a client arena; it cannot grow, so the arena size is the
+ * heap limit.
+ */
+static uintptr_t
+reserveCage(size_t size)
+{
+	size_t span = 3 * OopCage::kSize;
+	char *mem = (char *)mmap(NULL, span, PROT_NONE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	uintptr_t base;
+
+	if (mem == MAP_FAILED)
+		FATAL("Couldn't reserve the Oop cage");
+
+	base = ((uintptr_t)mem + OopCage::kSize - 1) & ~(OopCage::kSize - 1);
+	if ((base >> 32) == 1)
+		base += OopCage::kSize;
+	if (base > (uintptr_t)mem)
+		munmap(mem, base - (uintptr_t)mem);
+	munmap((char *)base + OopCage::kSize,
+	    (uintptr_t)mem + span - base - OopCage::kSize);
+
+	if (mmap((char *)base, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1,
+		0) == MAP_FAILED)
+		FATAL("Couldn't map the Oop cage");
+
+	return base;
+}
+#endif
+
+/*
+ * The MPS must be told of the dependent of a weak array, as the array's scan
+ * writes to it.
+ */
+static mps_addr_t
+findDependent(mps_addr_t addr)
+{
+	ObjectDesc *obj = (ObjectDesc *)addr;
+
+	if (obj->m_kind == ObjectDesc::kWeakArray)
+		return ((WeakArray *)obj)->m_dependent;
+	return NULL;
+}
+
+ObjectMemory::ObjectMemory(const HeapConfig &config)
+    : m_largeSize(config.m_largeObjectKB * 1024)
+    , m_hugePages(config.m_hugePages)
+    , m_pretenure(config.m_pretenure)
+    , m_epoch(0)
+    , m_pacer(config, m_telemetry)
 {
 	mps_res_t res;
-	static mps_gen_param_s obj_gen_params[] = {
-	    { 6400, 0.80 },
-	    { 6400, 0.80 },
-	    { 6400, 0.80 }
-	};
+	mps_gen_param_s obj_gen_params[HeapConfig::kMaxGenerations];
+	mps_gen_param_s code_gen_params;
+
+	memcpy(obj_gen_params, config.m_gens, sizeof(obj_gen_params));
 
 	if (m_mpsArena == NULL) {
+		size_t arenaSize = config.m_arenaKB * 1024;
+
+		if (m_hugePages)
+			arenaSize = (arenaSize + kHugePage - 1) &
+			    ~(kHugePage - 1);
+#ifdef XWS_COMPRESSED_OOPS
+		if (arenaSize > OopCage::kSize - OopCage::kGuard)
+			arenaSize = OopCage::kSize - OopCage::kGuard;
+		OopCage::s_base = reserveCage(OopCage::kGuard + arenaSize);
+#endif
 		MPS_ARGS_BEGIN (args) {
-			MPS_ARGS_ADD(args, MPS_KEY_ARENA_SIZE,
-			    32 * 1024 * 1024);
+			MPS_ARGS_ADD(args, MPS_KEY_ARENA_SIZE, arenaSize);
+			MPS_ARGS_ADD(args, MPS_KEY_SPARE, config.m_spare);
+			if (m_hugePages)
+				MPS_ARGS_ADD(args, MPS_KEY_ARENA_GRAIN_SIZE,
+				    kHugePage);
+#ifdef XWS_COMPRESSED_OOPS
+			MPS_ARGS_ADD(args, MPS_KEY_ARENA_CL_BASE,
+			    (void *)(OopCage::s_base + OopCage::kGuard));
+			MPS_ARGS_DONE(args);
+			res = mps_arena_create_k(&m_mpsArena,
+			    mps_arena_class_cl(), args);
+#else
 			MPS_ARGS_DONE(args);
 			res = mps_arena_create_k(&m_mpsArena,
 			    mps_arena_class_vm(), args);
+#endif
 		}
 		MPS_ARGS_END(args);
 		if (res != MPS_RES_OK)
 			FATAL("Couldn't create arena");
 	}
+	m_pacer.attach(m_mpsArena);
+	if (config.m_commitLimitKB &&
+	    !m_pacer.setCommitLimit(config.m_commitLimitKB))
+		FATAL("Couldn't set commit limit");
 
 	mps_message_type_enable(m_mpsArena, mps_message_type_gc());
 	mps_message_type_enable(m_mpsArena, mps_message_type_gc_start());
+	mps_message_type_enable(m_mpsArena, mps_message_type_finalization());
 
 	MPS_ARGS_BEGIN (args) {
 		MPS_ARGS_ADD(args, MPS_KEY_FMT_ALIGN, 16);
@@ -76,7 +160,7 @@ ObjectMemory::ObjectMemory()
 		FATAL("Couldn't create object format");
 
 	/** Create a generation chain. */
-	res = mps_chain_create(&m_mpsChain, m_mpsArena, LENGTH(obj_gen_params),
+	res = mps_chain_create(&m_mpsChain, m_mpsArena, config.m_nGenerations,
 	    obj_gen_params);
 	if (res != MPS_RES_OK)
 		FATAL("Couldn't create generation chain");
@@ -106,13 +190,121 @@ ObjectMemory::ObjectMemory()
 	MPS_ARGS_END(args);
 	if (res != MPS_RES_OK)
 		FATAL("Couldn't create object pool");
+
+	/** Create AMC pool for pretenured objects, in the second generation. */
+	MPS_ARGS_BEGIN (args) {
+		MPS_ARGS_ADD(args, MPS_KEY_CHAIN, m_mpsChain);
+		MPS_ARGS_ADD(args, MPS_KEY_FORMAT, m_mpsObjDescFmt);
+		MPS_ARGS_ADD(args, MPS_KEY_ALIGN, 32);
+		MPS_ARGS_ADD(args, MPS_KEY_GEN,
+		    config.m_nGenerations > 1 ? 1 : 0);
+		MPS_ARGS_DONE(args);
+		res = mps_pool_create_k(&m_mpsOldObjDescPool, m_mpsArena,
+		    mps_class_amc(), args);
+	}
+	MPS_ARGS_END(args);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create pretenured object pool");
+
+	/** Create AMS pool for large objects. */
+	MPS_ARGS_BEGIN (args) {
+		MPS_ARGS_ADD(args, MPS_KEY_CHAIN, m_mpsChain);
+		MPS_ARGS_ADD(args, MPS_KEY_FORMAT, m_mpsObjDescFmt);
+		MPS_ARGS_DONE(args);
+		res = mps_pool_create_k(&m_mpsLargeObjDescPool, m_mpsArena,
+		    mps_class_ams(), args);
+	}
+	MPS_ARGS_END(args);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create large object pool");
+
+	/** Create LO pool for large primitives. */
+	MPS_ARGS_BEGIN (args) {
+		MPS_ARGS_ADD(args, MPS_KEY_CHAIN, m_mpsChain);
+		MPS_ARGS_ADD(args, MPS_KEY_FORMAT, m_mpsPrimDescFmt);
+		MPS_ARGS_DONE(args);
+		res = mps_pool_create_k(&m_mpsLargePrimDescPool, m_mpsArena,
+		    mps_class_lo(), args);
+	}
+	MPS_ARGS_END(args);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create large leaf pool");
+
+	/** Create AWL pool for weak objects. */
+	MPS_ARGS_BEGIN (args) {
+		MPS_ARGS_ADD(args, MPS_KEY_CHAIN, m_mpsChain);
+		MPS_ARGS_ADD(args, MPS_KEY_FORMAT, m_mpsObjDescFmt);
+		MPS_ARGS_ADD(args, MPS_KEY_AWL_FIND_DEPENDENT, findDependent);
+		MPS_ARGS_DONE(args);
+		res = mps_pool_create_k(&m_mpsWeakPool, m_mpsArena,
+		    mps_class_awl(), args);
+	}
+	MPS_ARGS_END(args);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create weak pool");
+
+	/** Create the code space's chain, which code seldom dies out of. */
+	code_gen_params.mps_capacity = config.m_codeSpaceKB;
+	code_gen_params.mps_mortality = 0.1;
+	res = mps_chain_create(&m_mpsCodeChain, m_mpsArena, 1,
+	    &code_gen_params);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create code chain");
+
+	/** Create AMS pool for code. */
+	MPS_ARGS_BEGIN (args) {
+		MPS_ARGS_ADD(args, MPS_KEY_CHAIN, m_mpsCodeChain);
+		MPS_ARGS_ADD(args, MPS_KEY_FORMAT, m_mpsObjDescFmt);
+		MPS_ARGS_DONE(args);
+		res = mps_pool_create_k(&m_mpsCodeObjDescPool, m_mpsArena,
+		    mps_class_ams(), args);
+	}
+	MPS_ARGS_END(args);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create code pool");
+
+	/** Create LO pool for code's primitives. */
+	MPS_ARGS_BEGIN (args) {
+		MPS_ARGS_ADD(args, MPS_KEY_CHAIN, m_mpsCodeChain);
+		MPS_ARGS_ADD(args, MPS_KEY_FORMAT, m_mpsPrimDescFmt);
+		MPS_ARGS_DONE(args);
+		res = mps_pool_create_k(&m_mpsCodePrimDescPool, m_mpsArena,
+		    mps_class_lo(), args);
+	}
+	MPS_ARGS_END(args);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create code leaf pool");
+}
+
+size_t
+ObjectMemory::largeObjectsTotal()
+{
+	return mps_pool_total_size(m_mpsLargeObjDescPool) +
+	    mps_pool_total_size(m_mpsLargePrimDescPool);
+}
+
+size_t
+ObjectMemory::largeObjectsFree()
+{
+	return mps_pool_free_size(m_mpsLargeObjDescPool) +
+	    mps_pool_free_size(m_mpsLargePrimDescPool);
 }
 
 ObjectMemoryOSThread::ObjectMemoryOSThread(ObjectMemory &omem, void *marker)
     : m_omem(omem)
+    , m_codeDepth(0)
+    , m_bytesAllocated(0)
+    , m_heapLimitCallback(NULL)
+    , m_heapLimitData(NULL)
+    , m_inEmergency(false)
+    , m_nearLimit(false)
 {
 	mps_res_t res;
 
+	memset(m_largeCount, 0, sizeof(m_largeCount));
+	memset(m_largeBytes, 0, sizeof(m_largeBytes));
+	memset(m_advisedPages, 0, sizeof(m_advisedPages));
+
 	res = mps_ap_create_k(&m_mpsObjAP, omem.m_mpsObjDescPool,
 	    mps_args_none);
 	if (res != MPS_RES_OK)
@@ -123,20 +315,75 @@ ObjectMemoryOSThread::ObjectMemoryOSThread(ObjectMemory &omem, void *marker)
 	if (res != MPS_RES_OK)
 		FATAL("Couldn't create allocation point!");
 
+	res = mps_ap_create_k(&m_mpsOldObjAP, omem.m_mpsOldObjDescPool,
+	    mps_args_none);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create allocation point!");
+
+	res = mps_ap_create_k(&m_mpsLargeObjAP, omem.m_mpsLargeObjDescPool,
+	    mps_args_none);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create allocation point!");
+
+	res = mps_ap_create_k(&m_mpsLargeLeafObjAP,
+	    omem.m_mpsLargePrimDescPool, mps_args_none);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create allocation point!");
+
+	MPS_ARGS_BEGIN (args) {
+		MPS_ARGS_ADD(args, MPS_KEY_RANK, mps_rank_weak());
+		MPS_ARGS_DONE(args);
+		res = mps_ap_create_k(&m_mpsWeakAP, omem.m_mpsWeakPool, args);
+	}
+	MPS_ARGS_END(args);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create allocation point!");
+
+	MPS_ARGS_BEGIN (args) {
+		MPS_ARGS_ADD(args, MPS_KEY_RANK, mps_rank_exact());
+		MPS_ARGS_DONE(args);
+		res = mps_ap_create_k(&m_mpsWeakExactAP, omem.m_mpsWeakPool,
+		    args);
+	}
+	MPS_ARGS_END(args);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create allocation point!");
+
+	res = mps_ap_create_k(&m_mpsCodeObjAP, omem.m_mpsCodeObjDescPool,
+	    mps_args_none);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create allocation point!");
+
+	res = mps_ap_create_k(&m_mpsCodeLeafObjAP, omem.m_mpsCodePrimDescPool,
+	    mps_args_none);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create allocation point!");
+
 	res = mps_thread_reg(&m_mpsThread, omem.m_mpsArena);
 	if (res != MPS_RES_OK)
 		FATAL("Couldn't register thread");
 
+	res = mps_root_create(&m_mpsHandlesRoot, omem.m_mpsArena,
+	    mps_rank_exact(), 0, scanOopVec, &m_handles, 0);
+	if (res != MPS_RES_OK)
+		FATAL("Couldn't create root");
+
+#ifdef XWS_CONSERVATIVE_STACK
+	/*
+	 * For debugging native code suspected of holding Oops outside of
+	 * Handles: what the stack refers to is then kept alive and pinned.
+	 */
 	res = mps_root_create_thread_tagged(&m_mpsThreadRoot, omem.m_mpsArena,
-	    mps_rank_ambig(), 0, m_mpsThread, scanArea, 0, 0, marker);
+	    mps_rank_ambig(), 0, m_mpsThread, scanOopArea, 0, 0, marker);
 	if (res != MPS_RES_OK)
 		FATAL("Couldn't create root");
+#endif
 }
 
 mps_res_t
 PrimDesc::mpsScan(mps_ss_t ss, mps_addr_t base, mps_addr_t limit)
 {
-	printf("\n\n\nSCANNING PRIM\n\n\n");
+	xwsDbg("\n\n\nSCANNING PRIM\n\n\n");
 	MPS_SCAN_BEGIN (ss) {
 		while (base < limit) {
 			base = mpsSkip(base);
@@ -151,7 +398,7 @@ PrimDesc::mpsSkip(mps_addr_t base)
 {
 	PrimDesc *p = (PrimDesc *)base;
 
-	printf("Skipping prim %p\n", base);
+	xwsDbg("Skipping prim %p\n", base);
 
 	switch (p->m_kind) {
 	case kString:
@@ -164,6 +411,10 @@ PrimDesc::mpsSkip(mps_addr_t base)
 			base = ((char *)p + sizeof(PrimDesc));
 		break;
 
+	case kBytes:
+		base = (char *)p + ALIGN(sizeof(PrimDesc) + p->m_nBytes);
+		break;
+
 	case kDouble:
 	case kPad16:
 	case kFwd16:
@@ -193,7 +444,7 @@ PrimDesc::mpsFwd(mps_addr_t old, mps_addr_t newAddr)
 	mps_addr_t limit = mpsSkip(old);
 	size_t size = (char *)limit - (char *)old;
 
-	printf("Fwd Prim %p to %p\n", old, newAddr);
+	xwsDbg("Fwd Prim %p to %p\n", old, newAddr);
 
 	assert(size >= sizeof(PrimDesc));
 	if (size == sizeof(PrimDesc)) {
@@ -217,7 +468,7 @@ PrimDesc::mpsPad(mps_addr_t addr, size_t size)
 {
 	PrimDesc *p = (PrimDesc *)addr;
 
-	printf("Pad Prim %p to %lu\n", addr, size);
+	xwsDbg("Pad Prim %p to %lu\n", addr, size);
 
 	assert(size >= sizeof(PrimDesc));
 	if (size == sizeof(PrimDesc))
@@ -244,10 +495,140 @@ PrimDesc::mpsPad(mps_addr_t addr, size_t size)
 		}                                                       \
 	}
 
+/*
+ * As FIXOOP, but for a reference that may be weak: if the MPS finds its
+ * referent dead, it is replaced with \p dead and \p onDeath is run.
+ */
+#define FIXWEAKOOP(oop, dead, onDeath)                                  \
+	if (MPS_FIX1(ss, oop.m_full)) {                                 \
+		if (oop.isPtr()) {                                      \
+			mps_word_t tag = oop.tag();                     \
+			mps_addr_t ref = (mps_addr_t)oop.addrT<void>(); \
+			mps_res_t res = MPS_FIX2(ss, &ref);             \
+                                                                        \
+			if (res != MPS_RES_OK)                          \
+				return res;                             \
+                                                                        \
+			if (ref == NULL) {                              \
+				oop = dead;                             \
+				onDeath;                                \
+			} else                                          \
+				oop.m_full = (mps_word_t)ref | tag;     \
+		}                                                       \
+	}
+
+/* Oops and OopSlots alike, for FIXSLOT and fixOops() */
+static inline Oop
+slotGet(const Oop &oop)
+{
+	return oop;
+}
+
+template <class T>
+static inline Oop
+slotGet(const OopSlot<T> &slot)
+{
+	return slot.get();
+}
+
+static inline void
+slotSet(Oop &oop, Oop val)
+{
+	oop = val;
+}
+
+template <class T>
+static inline void
+slotSet(OopSlot<T> &slot, Oop val)
+{
+	slot.set(val);
+}
+
+/*
+ * Zero if the Oop or OopSlot holds a Smi: a full Oop's upper half is then 1
+ * (see Oop(int32_t)), and a compressed OopSlot's bit 0 is set (see OopCage).
+ */
+static inline uintptr_t
+slotNonSmi(const Oop &oop)
+{
+	return (oop.m_full >> 32) ^ 1;
+}
+
+template <class T>
+static inline uintptr_t
+slotNonSmi(const OopSlot<T> &slot)
+{
+#ifdef XWS_COMPRESSED_OOPS
+	return ~slot.bits() & 1;
+#else
+	return (slot.bits() >> 32) ^ 1;
+#endif
+}
+
+/*
+ * As FIXOOP, but for an OopSlot (or Oop): it is fixed as a full Oop, which is
+ * stored back only if the referent moved.
+ */
+#define FIXSLOT(slot)                                                   \
+	{                                                               \
+		Oop slotOop = slotGet(slot);                            \
+		mps_word_t slotOld = slotOop.m_full;                    \
+                                                                        \
+		FIXOOP(slotOop);                                        \
+		if (slotOop.m_full != slotOld)                          \
+			slotSet(slot, slotOop);                         \
+	}
+
+/** Oops taken together by fixOops(). */
+static const size_t kScanBlock = 8;
+
+/*
+ * Fix the \p n Oops or OopSlots at \p oops. Arrays are often mostly Smis,
+ * which need no fixing, so they are taken kScanBlock at a time: a block all of
+ * whose Oops are Smis is skipped on one test of the disjunction of their
+ * slotNonSmi(), which the compiler does with vector ORs; in any other, the
+ * referents are prefetched before the first of them is fixed. Smis are never
+ * passed to the MPS, whose value could otherwise pass for a pointer.
+ */
+template <class S>
+static mps_res_t
+fixOops(mps_ss_t ss, S *oops, size_t n)
+{
+	size_t i = 0;
+
+	MPS_SCAN_BEGIN (ss) {
+		for (; i + kScanBlock <= n; i += kScanBlock) {
+			S *block = oops + i;
+			uintptr_t any = 0;
+
+			for (size_t j = 0; j < kScanBlock; j++)
+				any |= slotNonSmi(block[j]);
+			if (any == 0)
+				continue;
+
+			for (size_t j = 0; j < kScanBlock; j++) {
+				Oop oop = slotGet(block[j]);
+
+				if (slotNonSmi(block[j]))
+					__builtin_prefetch(oop.addrT<void>());
+			}
+			for (size_t j = 0; j < kScanBlock; j++)
+				if (slotNonSmi(block[j]))
+					FIXSLOT(block[j]);
+		}
+		for (; i < n; i++)
+			if (slotNonSmi(oops[i]))
+				FIXSLOT(oops[i]);
+	}
+	MPS_SCAN_END(ss);
+
+	return MPS_RES_OK;
+}
+
 mps_res_t
 ObjectDesc::mpsScan(mps_ss_t ss, mps_addr_t base, mps_addr_t limit)
 {
-	gcDbg("** Scan Object");
+	xwsDbg("** Scan Object");
 	MPS_SCAN_BEGIN (ss) {
 		while (base < limit) {
 			ObjectDesc * obj = (ObjectDesc*)base;
@@ -256,26 +637,28 @@ ObjectDesc::mpsScan(mps_ss_t ss, mps_addr_t base, mps_addr_t limit)
 			switch (obj->m_kind) {
 			case kFwd: {
 				Fwd *fwd = (Fwd *)obj;
-				base = addr + fwd->m_fwdLen;
+				base = addr + fwd->m_length;
 				break;
 			}
 
 			case kPad: {
 				Pad *pad = (Pad *)obj;
-				base = addr + pad->m_padLen;
+				base = addr + pad->m_length;
 				break;
 			}
 
 			case kEnvironmentMap: {
 				EnvironmentMap *map = (EnvironmentMap *)obj;
 				size_t nEntries = map->m_nLocals + map->m_nParams;
+				mps_res_t res;
 
-				for (int i = 0;
-				     i < map->m_nLocals + map->m_nParams; i++)
-					FIXOOP(map->m_names[i]);
+				MPS_FIX_CALL(ss, res = fixOops(ss, map->m_names,
+				    nEntries));
+				if (res != MPS_RES_OK)
+					return res;
 
 				base = addr + ALIGN(sizeof(EnvironmentMap) +
-				    sizeof(Oop) * nEntries);
+				    sizeof(OopSlot<>) * nEntries);
 
 				break;
 			}
@@ -283,10 +666,10 @@ ObjectDesc::mpsScan(mps_ss_t ss, mps_addr_t base, mps_addr_t limit)
 			case kEnvironment: {
 				Environment * env = (Environment*) obj;
 
-				FIXOOP(env->m_prev);
-				FIXOOP(env->m_map);
-				FIXOOP(env->m_args);
-				FIXOOP(env->m_locals);
+				FIXSLOT(env->m_prev);
+				FIXSLOT(env->m_map);
+				FIXSLOT(env->m_args);
+				FIXSLOT(env->m_locals);
 
 				base = addr + ALIGN(sizeof(Environment));
 
@@ -295,12 +678,15 @@ ObjectDesc::mpsScan(mps_ss_t ss, mps_addr_t base, mps_addr_t limit)
 
 			case kPlainArray: {
 				PlainArray * arr = (PlainArray*)obj;
+				mps_res_t res;
 
-				for (int i = 0; i < arr->m_nElements; i++)
-					FIXOOP(arr->m_elements[i]);
+				MPS_FIX_CALL(ss, res = fixOops(ss,
+				    arr->m_elements, arr->m_length));
+				if (res != MPS_RES_OK)
+					return res;
 
 				base = addr + ALIGN(sizeof(PlainArray) +
-				    sizeof(Oop) * arr->m_nElements);
+				    sizeof(OopSlot<>) * arr->m_length);
 
 				break;
 			}
@@ -313,34 +699,135 @@ ObjectDesc::mpsScan(mps_ss_t ss, mps_addr_t base, mps_addr_t limit)
 			case kCharArray: {
 				CharArray * arr = (CharArray*)obj;
 				base = addr + ALIGN(sizeof(CharArray) +
-				    sizeof(char) * arr->m_nElements);
+				    sizeof(char) * arr->m_length);
 				break;
 			}
 
 			/* these are pseudo for now but need to be promoted */
 			case kFunction: {
 				Function * fun = (Function*) obj;
+				mps_res_t res;
 
 				FIXOOP(fun->m_map);
-				FIXOOP(fun->m_bytecode);
-				FIXOOP(fun->m_literals);
+				FIXOOP(fun->m_handlers);
+				MPS_FIX_CALL(ss, res = fixOops(ss,
+				    fun->m_literals, fun->m_nLiterals));
+				if (res != MPS_RES_OK)
+					return res;
 
-				base = addr + ALIGN(sizeof(Function));
+				base = addr + ALIGN(sizeof(Function) +
+				    sizeof(OopSlot<>) * fun->m_nLiterals +
+				    fun->m_length);
 
 				break;
 			}
 
 			case kClosure: {
 				Closure * closure = (Closure*) obj;
+				mps_word_t func = closure->m_func.m_full;
 
 				FIXOOP(closure->m_baseEnv);
 				FIXOOP(closure->m_func);
+				/* by as much, without reading the Function */
+				closure->m_code += closure->m_func.m_full - func;
 
 				base = addr + ALIGN(sizeof(Closure));
 
 				break;
 			}
 
+			case kActivation: {
+				Activation * act = (Activation*) obj;
+
+				FIXOOP(act->m_closure);
+				FIXOOP(act->m_env);
+				FIXOOP(act->m_promise);
+				FIXOOP(act->m_slots);
+				FIXOOP(act->m_result);
+
+				base = addr + ALIGN(sizeof(Activation));
+
+				break;
+			}
+
+			case kPromise: {
+				Promise * promise = (Promise*) obj;
+
+				FIXOOP(promise->m_reaction);
+				FIXOOP(promise->m_reactions);
+				FIXOOP(promise->m_result);
+
+				base = addr + ALIGN(sizeof(Promise));
+
+				break;
+			}
+
+			case kNativeFunction:
+				base = addr + ALIGN(sizeof(NativeFunction));
+				break;
+
+			case kArrayBuffer: {
+				ArrayBuffer * buf = (ArrayBuffer*) obj;
+
+				FIXOOP(buf->m_store);
+
+				base = addr + ALIGN(sizeof(ArrayBuffer));
+
+				break;
+			}
+
+			case kWeakRef: {
+				WeakRef *weak = (WeakRef *)obj;
+
+				FIXWEAKOOP(weak->m_target,
+				    ObjectMemory::s_undefined, (void)0);
+
+				base = addr + ALIGN(sizeof(WeakRef));
+
+				break;
+			}
+
+			case kWeakArray: {
+				WeakArray *arr = (WeakArray *)obj;
+				WeakArray *dep = arr->m_dependent;
+
+				for (size_t i = 0; i < arr->m_length; i++)
+					FIXWEAKOOP(arr->m_elements[i],
+					    ObjectMemory::s_null,
+					    if (dep) dep->m_elements[i] =
+						ObjectMemory::s_undefined);
+
+				base = addr + ALIGN(sizeof(WeakArray) +
+				    sizeof(Oop) * arr->m_length);
+
+				break;
+			}
+
+			case kWeakMap: {
+				WeakMap *map = (WeakMap *)obj;
+
+				FIXOOP(map->m_keys);
+				FIXOOP(map->m_values);
+
+				base = addr + ALIGN(sizeof(WeakMap));
+
+				break;
+			}
+
+			case kFinalizationRegistry: {
+				FinalizationRegistry *reg =
+				    (FinalizationRegistry *)obj;
+
+				FIXOOP(reg->m_callback);
+				FIXOOP(reg->m_targets);
+				FIXOOP(reg->m_held);
+
+				base = addr +
+				    ALIGN(sizeof(FinalizationRegistry));
+
+				break;
+			}
+
 			default: {
 				printf("Bad Object\n");
 				abort();
@@ -355,26 +842,26 @@ ObjectDesc::mpsScan(mps_ss_t ss, mps_addr_t base, mps_addr_t limit)
 mps_addr_t
 ObjectDesc::mpsSkip(mps_addr_t base)
 {
-	gcDbg("Skip Object %p\n", base);
+	xwsDbg("Skip Object %p\n", base);
 	ObjectDesc *obj = (ObjectDesc *)base;
 	char *addr = (char *)obj;
 
 	switch (obj->m_kind) {
 	case kFwd: {
 		Fwd *fwd = (Fwd *)obj;
-		return addr + fwd->m_fwdLen;
+		return addr + fwd->m_length;
 	}
 
 	case kPad: {
 		Pad *pad = (Pad *)obj;
-		return addr + pad->m_padLen;
+		return addr + pad->m_length;
 	}
 
 	case kEnvironmentMap: {
 		EnvironmentMap *map = (EnvironmentMap *)obj;
 		size_t nEntries = map->m_nLocals + map->m_nParams;
-		return addr + ALIGN(sizeof(EnvironmentMap) + sizeof(Oop) *
-		    nEntries);
+		return addr + ALIGN(sizeof(EnvironmentMap) +
+		    sizeof(OopSlot<>) * nEntries);
 	}
 
 	case kEnvironment: {
@@ -384,8 +871,8 @@ ObjectDesc::mpsSkip(mps_addr_t base)
 
 	case kPlainArray: {
 		PlainArray *arr = (PlainArray *)obj;
-		return addr + ALIGN(sizeof(PlainArray) + sizeof(Oop) *
-		    arr->m_nElements);
+		return addr + ALIGN(sizeof(PlainArray) +
+		    sizeof(OopSlot<>) * arr->m_length);
 	}
 
 	case kMap: {
@@ -395,13 +882,14 @@ ObjectDesc::mpsSkip(mps_addr_t base)
 	case kCharArray: {
 		CharArray *arr = (CharArray *)obj;
 		return addr + ALIGN(sizeof(CharArray) + sizeof(char) *
-		    arr->m_nElements);
+		    arr->m_length);
 	}
 
 	/* these are pseudo for now but need to be promoted */
 	case kFunction: {
 		Function *fun = (Function *)obj;
-		return addr + ALIGN(sizeof(Function));
+		return addr + ALIGN(sizeof(Function) +
+		    sizeof(OopSlot<>) * fun->m_nLiterals + fun->m_length);
 	}
 
 	case kClosure: {
@@ -409,6 +897,31 @@ ObjectDesc::mpsSkip(mps_addr_t base)
 		return addr + ALIGN(sizeof(Closure));
 	}
 
+	case kActivation:
+		return addr + ALIGN(sizeof(Activation));
+
+	case kPromise:
+		return addr + ALIGN(sizeof(Promise));
+
+	case kNativeFunction:
+		return addr + ALIGN(sizeof(NativeFunction));
+
+	case kArrayBuffer:
+		return addr + ALIGN(sizeof(ArrayBuffer));
+
+	case kWeakRef:
+		return addr + ALIGN(sizeof(WeakRef));
+
+	case kWeakArray:
+		return addr + ALIGN(sizeof(WeakArray) + sizeof(Oop) *
+		    ((WeakArray *)obj)->m_length);
+
+	case kWeakMap:
+		return addr + ALIGN(sizeof(WeakMap));
+
+	case kFinalizationRegistry:
+		return addr + ALIGN(sizeof(FinalizationRegistry));
+
 	default:
 		printf("Bad object %p\n", obj);
 		abort();
@@ -422,11 +935,12 @@ ObjectDesc::mpsFwd(mps_addr_t old, mps_addr_t newAddr)
 	mps_addr_t limit = mpsSkip(old);
 	size_t size = (char *)limit - (char *)old;
 
-	gcDbg("Fwd Object %p to %p\n", old, newAddr);
+	xwsDbg("Fwd Object %p to %p\n", old, newAddr);
 
 	assert(size >= sizeof(Fwd));
 	p->m_kind = kFwd;
-	p->m_fwdLen = size;
+	p->m_length = size;
+	p->m_fwdPtr = (ObjectDesc *)newAddr;
 }
 
 mps_addr_t
@@ -441,24 +955,24 @@ ObjectDesc::mpsPad(mps_addr_t addr, size_t size)
 {
 	Pad *p = (Pad *)addr;
 
-	gcDbg("Pad Obj %p to %lu\n", addr, size);
+	xwsDbg("Pad Obj %p to %lu\n", addr, size);
 
 	assert(size >= sizeof(Pad));
 	p->m_kind = kPad;
-	p->m_padLen = size;
+	p->m_length = size;
 }
 
 /**
  * An MPS area scanner; it scans the area between \p base and \p limit one word
  * at-a-time and submits it to MPS if it appears to be a pointer Oop.
  *
- * Though MPS_FIX2 is called, which can ordinarily update a pointer, it won't
- * happen here since this function is invoked for conservative scans.
+ * For an ambiguous root MPS_FIX2 leaves the reference as it is; for an exact
+ * one it may update it.
  */
-static mps_res_t
-scanArea(mps_ss_t ss, void *base, void *limit, void *closure)
+mps_res_t
+scanOopArea(mps_ss_t ss, void *base, void *limit, void *closure)
 {
-	printf("Scanning stack/register (region %p-%p)\n", base, limit);
+	xwsDbg("Scanning stack/register (region %p-%p)\n", base, limit);
 
 	MPS_SCAN_BEGIN (ss) {
 		mps_word_t *p = (mps_word_t *)base;
@@ -466,7 +980,8 @@ scanArea(mps_ss_t ss, void *base, void *limit, void *closure)
 			/* First check if this is of interest to MPS */
 			if (MPS_FIX1(ss, *p)) {
 				Oop* oop = (Oop *)p;
-				printf("Found potential pointer %p\n", (void*)*p);
+				xwsDbg("Found potential pointer %p\n",
+				    (void *)*p);
 				if (oop->isPtr()) {
 					/* Extract the tag  */
 					mps_word_t tag = oop->tag();
@@ -478,13 +993,6 @@ scanArea(mps_ss_t ss, void *base, void *limit, void *closure)
 					if (res != MPS_RES_OK)
 						return res;
 
-					/*
-					 * Should not be strictly-speaking
-					 * necessary as this function should
-					 * only be invoked for conservative
-					 * scans that don't change references,
-					 * but just in case, reapply the tag.
-					 */
 					*p = (mps_word_t)ref | tag;
 				}
 			}
@@ -501,12 +1009,41 @@ scanOopVec(mps_ss_t ss, void *p, size_t s)
 {
 	std::vector<Oop> *vec = (std::vector<Oop> *)p;
 
+	return vec->empty() ? MPS_RES_OK : fixOops(ss, &(*vec)[0],
+	    vec->size());
+}
+
+mps_res_t
+scanWeakOopVec(mps_ss_t ss, void *p, size_t s)
+{
+	std::vector<Oop> *vec = (std::vector<Oop> *)p;
+
+	MPS_SCAN_BEGIN (ss) {
+		for (size_t i = 0; i < vec->size(); i++) {
+			FIXWEAKOOP((*vec)[i], ObjectMemory::s_undefined,
+			    (void)0);
+		}
+	}
+	MPS_SCAN_END(ss);
+
+	return MPS_RES_OK;
+}
+
+mps_res_t
+scanPinnedVec(mps_ss_t ss, void *p, size_t s)
+{
+	std::vector<void *> *vec = (std::vector<void *> *)p;
+
 	MPS_SCAN_BEGIN (ss) {
-		for (int i = 0; i < vec->size(); i++) {
-			FIXOOP((*vec)[i]);
+		for (size_t i = 0; i < vec->size(); i++) {
+			mps_addr_t ref = (*vec)[i];
+			mps_res_t res = MPS_FIX12(ss, &ref);
+
+			if (res != MPS_RES_OK)
+				return res;
 		}
 	}
 	MPS_SCAN_END(ss);
 
 	return MPS_RES_OK;
-}
\ No newline at end of file
+}
@@ -1,4 +1,5 @@
 
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -11,6 +12,7 @@
 #include "Driver.hh"
 #include "Scanner.ll.hh"
 #include "AST.hh"
+#include "EventLoop.hh"
 #include "VM.hh"
 
 std::ostream& ital(std::ostream& os)
@@ -47,12 +49,21 @@ int main2(int argc, char * argv[], ObjectMemoryOSThread& omemt)
 	/* And, finally, destroy this scanner. */
 	jslex_destroy(drv.scanner);
 
-	VM::Interpreter interp(omemt, omemt.makeClosure(drv.generateBytecode(),
-	    *(MemOop<Environment> *)&ObjectMemory::s_undefined));
+	EventLoop loop(omemt);
+	HandleScope scope(omemt);
+	Handle<Function> script(omemt, drv.generateBytecode());
+	Handle<Environment> globals(omemt, loop.makeGlobals());
+	VM::Interpreter interp(omemt, omemt.makeClosure(script, globals));
+	interp.setEventLoop(&loop);
 	std::cout << "Evaluating bytecode corresponding to JS source:\n";
 	std::cout << ital << tst << def << "\n";
 
-	interp.interpret();
+	try {
+		interp.interpret();
+	} catch (VM::Termination &term) {
+		std::cout << "Script terminated: " << term.m_reason << "\n";
+		return 1;
+	}
 
 	return 0;
 }
@@ -61,7 +72,15 @@ int
 main(int argc, char *argv[])
 {
 	void * marker = &marker;
-	ObjectMemory omem;
+	HeapConfig config;
+	const char *spec = getenv("XWS_HEAP");
+
+	if (spec && !config.parse(spec)) {
+		std::cerr << "Invalid XWS_HEAP setting: " << spec << "\n";
+		return 1;
+	}
+
+	ObjectMemory omem(config);
 	ObjectMemoryOSThread omemt(omem, marker);
 	return main2(argc, argv, omemt);
 }
@@ -1,6 +1,7 @@
 #ifndef OBJECT_H_
 #define OBJECT_H_
 
+#include <cstdio>
 #include <iostream>
 #include <map>
 #include <stdint.h>
@@ -10,6 +11,16 @@ extern "C" {
 #include "mpstd.h" /* for MPS_BUILD_MV */
 }
 
+/*
+ * Tracing of the compiler, interpreter and collector. It is compiled in only
+ * if XWS_DEBUG is defined, as it is for debug builds.
+ */
+#ifdef XWS_DEBUG
+#define xwsDbg(...) printf(__VA_ARGS__)
+#else
+#define xwsDbg(...) ((void)0)
+#endif
+
 class ObjectMemory;
 
 namespace VM {
@@ -38,6 +49,13 @@ class Interpreter;
  * - 12: String
  * - 14: Object
  *
+ * Compressed Oops
+ * ---------------
+ * Built with XWS_COMPRESSED_OOPS, the heap lies in a 4 GB-aligned cage (see
+ * ObjectMemory) and the Oops in PlainArrays, EnvironmentMaps and Environments,
+ * where most of them are, are stored as 32 bits; see OopSlot. Other objects'
+ * fields, and Oops outside the heap, stay full width.
+ *
  * Heap Objects
  * ------------
  * These include both primitives and proper Objects.
@@ -50,6 +68,8 @@ class ObjectDesc;
 class PrimDesc;
 class ObjectMemory;
 class ObjectMemoryOSThread;
+class Promise;
+struct WeakArray;
 template <class T> class MemOop;
 typedef MemOop<PrimDesc> PrimOop;
 
@@ -160,6 +180,79 @@ template <class T = PrimDesc> class MemOop : public Oop {
 	inline T *operator->() { return Oop::template addrT<T>(); }
 };
 
+#ifdef XWS_COMPRESSED_OOPS
+/**
+ * The cage the heap lies in, and the compression of Oops within it. The cage
+ * is aligned to 4 GB, so a pointer into it is compressed to its low 32 bits,
+ * tag included. Its first #kGuard bytes are not given to the heap, so those
+ * values instead stand for themselves, as undefined, null and the booleans
+ * do. A Smi, which must fit in 31 bits, is shifted left and tagged with 1.
+ */
+class OopCage {
+    public:
+	static const uintptr_t kSize = (uintptr_t)1 << 32;
+	static const uint32_t kGuard = 0x10000;
+	static uintptr_t s_base;
+
+	static inline uint32_t compress(Oop oop)
+	{
+		/* see Oop(int32_t) */
+		if ((oop.m_full >> 32) == 1)
+			return (uint32_t)oop.asI32() << 1 | 1;
+		return (uint32_t)oop.m_full;
+	}
+
+	static inline Oop decompress(uint32_t bits)
+	{
+		if (bits & 1)
+			return Oop((int32_t)bits >> 1);
+		else if (bits < kGuard)
+			return Oop((void *)(uintptr_t)bits);
+		return Oop((void *)(s_base | bits));
+	}
+};
+#endif
+
+/**
+ * An Oop, referring to a \p T, as stored in the arrays and environments that
+ * hold most of the heap's Oops: 32 bits with XWS_COMPRESSED_OOPS, and a plain
+ * Oop otherwise. It is read and written as a \p T.
+ */
+template <class T = Oop> class OopSlot {
+#ifdef XWS_COMPRESSED_OOPS
+	uint32_t m_bits;
+
+    public:
+	inline T get() const
+	{
+		Oop oop = OopCage::decompress(m_bits);
+
+		return *(T *)&oop;
+	}
+	inline void set(Oop oop) { m_bits = OopCage::compress(oop); }
+	/** The stored bits; a Smi's have bit 0 set. */
+	inline uintptr_t bits() const { return m_bits; }
+#else
+	T m_oop;
+
+    public:
+	inline T get() const { return m_oop; }
+	inline void set(Oop oop) { m_oop = *(T *)&oop; }
+	inline uintptr_t bits() const { return m_oop.m_full; }
+#endif
+
+	OopSlot() { }
+	OopSlot(Oop oop) { set(oop); }
+
+	inline operator T() const { return get(); }
+	inline OopSlot &operator=(Oop oop)
+	{
+		set(oop);
+		return *this;
+	}
+	inline T operator->() const { return get(); }
+};
+
 /** Singleton undefined. */
 class UndefinedDesc {
 	int64_t padding1, padding2;
@@ -181,6 +274,7 @@ struct PrimDesc {
 		kString,
 		kSymbol,
 		kDouble,
+		kBytes, /**< backing store of an ArrayBuffer */
 		kPad16,
 		kPad,
 		kFwd16,
@@ -193,6 +287,11 @@ struct PrimDesc {
 		 * String length, minus NULL byte.
 		 */
 		size_t m_strLen;
+		/**
+		 * Length of a byte store's contents, which follow the header
+		 * (see bytes()).
+		 */
+		size_t m_nBytes;
 		/**
 		 * Length of whole padding object.
 		 */
@@ -207,6 +306,9 @@ struct PrimDesc {
 		} __attribute__((packed));
 	} __attribute__((packed));
 
+	/** The contents of a byte store. */
+	inline char *bytes() { return (char *)(this + 1); }
+
 	static mps_res_t mpsScan(mps_ss_t ss, mps_addr_t base,
 	    mps_addr_t limit);
 	static mps_addr_t mpsSkip(mps_addr_t base);
@@ -231,16 +333,38 @@ class ObjectDesc {
 		/* these are pseudo for now but need to be promoted */
 		kFunction,
 		kClosure,
+		kActivation,
+		kPromise,
+		kNativeFunction,
+		kArrayBuffer,
+		kWeakRef,
+		kWeakArray,
+		kWeakMap,
+		kFinalizationRegistry,
 
 		/*
 		 * the following are proper objects (subclass ProperObjectDesc)
 		 */
 	};
 
+	/*
+	 * The header, one word. Arrays keep their lengths in it rather than
+	 * after it, so that a small array takes 16 bytes fewer.
+	 */
 	struct {
-		Kind m_kind: 16;
-		int16_t m_bits;
-		int32_t m_fwdLen;
+		Kind m_kind : 8;
+		/**
+		 * For a sampled object, the epoch (mod 256) at which it was
+		 * sampled; see ObjectMemory::sampleDied().
+		 */
+		uint8_t m_age;
+		/** For a sampled object, the id of its AllocSite; else 0. */
+		uint16_t m_bits;
+		/**
+		 * Of an array, the count of its elements; of a Function, the
+		 * length of its bytecode; of a Fwd or Pad, its size in bytes.
+		 */
+		uint32_t m_length;
 	};
 
 	ObjectDesc(Kind kind): m_kind(kind) {};
@@ -258,24 +382,22 @@ struct Fwd : public ObjectDesc {
 	ObjectDesc *m_fwdPtr;
 };
 
+/** Of any size from 8 bytes, as it is all header. */
 struct Pad : public ObjectDesc {
-	size_t m_padLen;
 };
 
 struct CharArray: public ObjectDesc {
-	size_t m_nElements;
 	char m_elements[0];
 };
 
 struct PlainArray: public ObjectDesc {
-	size_t m_nElements;
-	Oop m_elements[0];
+	OopSlot<> m_elements[0];
 };
 
 struct EnvironmentMap : public ObjectDesc {
-	size_t m_nParams;
-	size_t m_nLocals;
-	PrimOop m_names[0]; /* param names followed by locals */
+	uint32_t m_nParams;
+	uint32_t m_nLocals;
+	OopSlot<PrimOop> m_names[0]; /* param names followed by locals */
 
 	EnvironmentMap(size_t nParams, size_t nLocals)
 	    : ObjectDesc(kEnvironmentMap)
@@ -284,10 +406,10 @@ struct EnvironmentMap : public ObjectDesc {
 };
 
 struct Environment : public ObjectDesc {
-	MemOop<EnvironmentMap> m_map;
-	MemOop<Environment> m_prev;
-	MemOop<PlainArray> m_args;
-	MemOop<PlainArray> m_locals;
+	OopSlot<MemOop<EnvironmentMap> > m_map;
+	OopSlot<MemOop<Environment> > m_prev;
+	OopSlot<MemOop<PlainArray> > m_args;
+	OopSlot<MemOop<PlainArray> > m_locals;
 
 	Environment(MemOop<Environment> prev, MemOop<EnvironmentMap> map,
 	    MemOop<PlainArray> args, MemOop<PlainArray> locals)
@@ -297,7 +419,8 @@ struct Environment : public ObjectDesc {
 	    , m_args(args)
 	    , m_locals(locals) {};
 
-	Oop &lookup(const char *val);
+	/** Resolve an identifier along the chain; NULL if unbound. */
+	OopSlot<> *lookup(const char *val);
 };
 
 /**
@@ -333,13 +456,43 @@ struct Map : public ObjectDesc {
 };
 
 /**
- * An underlying JavaScript function object.
+ * An underlying JavaScript function object. Its literals follow it, and its
+ * bytecode (#m_length bytes) follows them, so that running it touches one
+ * object rather than three.
  */
 class Function : public ObjectDesc  {
     public:
 	MemOop<EnvironmentMap> m_map;
-	MemOop<CharArray> m_bytecode;
-	MemOop<PlainArray> m_literals;
+	/**
+	 * Exception handler table, as Smi quadruples of [ start, end, handler,
+	 * depth ]: an exception raised by an instruction in bytecode range
+	 * [start, end) is handled at offset `handler`, with the operand stack
+	 * cut back to `depth` slots above the frame base and the exception
+	 * value pushed. Inner handlers precede outer ones. Nothing is executed
+	 * on entry to a try block; the table is only consulted when unwinding.
+	 */
+	MemOop<PlainArray> m_handlers;
+	/** What calling the function does. */
+	enum Type {
+		kPlain,	    /**< runs the body */
+		kGenerator, /**< returns an Activation, resumed by iterating it */
+		kAsync,	    /**< runs the body in an Activation until it awaits */
+	} m_type;
+	/**
+	 * Hotness counter. Bumped on each invocation and on each back edge
+	 * taken within the function, so that a function which is entered
+	 * once but loops for a long time still becomes hot.
+	 */
+	int32_t m_hotness;
+	/**
+	 * Bytecode offset of the loop header at which the function last
+	 * became hot, or -1. This is the on-stack replacement entry point.
+	 */
+	int32_t m_osrEntry;
+	uint32_t m_nLiterals;
+	OopSlot<> m_literals[0];
+
+	inline char *bytecode() { return (char *)(m_literals + m_nLiterals); }
 
 	void disassemble(); /* bytecode.cc */
 };
@@ -351,6 +504,194 @@ class Closure : public ObjectDesc {
     public:
 	MemOop<Function> m_func;
 	MemOop<Environment> m_baseEnv;
+	/**
+	 * The bytecode of #m_func, for the interpreter to enter without going
+	 * through it. The collector moves it along with #m_func.
+	 */
+	char *m_code;
+};
+
+/**
+ * The frame of a generator or async function invocation, which must outlive
+ * its place on the interpreter stack. Most of a frame already lives in the
+ * heap (the closure and environment), so suspending need only save the pc and
+ * whatever operand stack slots are live; resuming pushes those back.
+ */
+class Activation : public ObjectDesc {
+    public:
+	enum State {
+		kStart,	    /**< not yet run */
+		kSuspended, /**< at a yield or await */
+		kRunning,
+		kDone,	    /**< returned; #m_result is the return value */
+		kFailed,    /**< threw; #m_result is the exception */
+	};
+
+	MemOop<Closure> m_closure;
+	MemOop<Environment> m_env;
+	/** For an async function, the Promise of its result; else undefined. */
+	MemOop<Promise> m_promise;
+	/**
+	 * Operand stack slots saved on suspension; undefined until some are.
+	 * Reused by later suspensions if large enough.
+	 */
+	MemOop<PlainArray> m_slots;
+	Oop m_result;
+	int32_t m_pc;
+	uint32_t m_nSlots; /**< live elements of #m_slots */
+	State m_state;
+};
+
+/**
+ * A promise. Settling it queues a microtask for each of its reactions, which
+ * are what to run with it once settled: an Activation awaiting it, or a
+ * Promise which has adopted it.
+ */
+class Promise : public ObjectDesc {
+    public:
+	enum State {
+		kPending,
+		kFulfilled,
+		kRejected,
+	};
+
+	/**
+	 * The first reaction, or undefined. Usually a promise is awaited once
+	 * if at all, so this is stored inline and awaiting allocates nothing.
+	 */
+	Oop m_reaction;
+	/** Any further reactions; undefined until there are some. */
+	MemOop<PlainArray> m_reactions;
+	/** The value or reason, once settled. */
+	Oop m_result;
+	uint32_t m_nReactions; /**< live elements of #m_reactions */
+	State m_state;
+};
+
+/**
+ * A function implemented by the host. It is called with the arguments in
+ * source order; \p args points into the interpreter's stack, so it must not
+ * call back into the interpreter other than to queue work.
+ */
+class NativeFunction : public ObjectDesc {
+    public:
+	typedef Oop (*Fn)(VM::Interpreter &interp, void *data, Oop *args,
+	    size_t nArgs);
+
+	Fn m_fn;
+	void *m_data; /**< passed to #m_fn */
+	const char *m_name;
+};
+
+/**
+ * An ArrayBuffer. Its contents are usually a byte store in the leaf pool, which
+ * the collector never scans, so that I/O can be done straight into it; while
+ * that is in progress the store is pinned by an ambiguous root.
+ *
+ * Alternatively they are external, such as a mapped file, and the collector
+ * knows nothing of them; such a buffer is registered for finalization, which
+ * releases them.
+ */
+class ArrayBuffer : public ObjectDesc {
+    public:
+	/** Frees the contents of an external buffer. */
+	typedef void (*Release)(void *data, size_t len);
+
+	/** The byte store, or undefined if the contents are external. */
+	PrimOop m_store;
+	void *m_external;
+	Release m_release;
+	size_t m_byteLength;
+
+	inline char *data()
+	{
+		return m_store.isUndefined() ? (char *)m_external :
+		    m_store->bytes();
+	}
+};
+
+/*
+ * Weak objects live in the AWL pool, which never moves them; see ObjectMemory.
+ * Where the collector finds a weak reference's referent dead, it replaces the
+ * reference with null, or undefined in a WeakRef.
+ */
+
+/** A WeakRef, allocated with weak rank. */
+class WeakRef : public ObjectDesc {
+    public:
+	Oop m_target;
+};
+
+/**
+ * An array of Oops, weak if allocated with weak rank. When an element of a weak
+ * one is cleared, so is the same element of #m_dependent, if any; that is how a
+ * table's values die with their keys.
+ */
+struct WeakArray : public ObjectDesc {
+	WeakArray *m_dependent;
+	Oop m_elements[0];
+};
+
+/**
+ * A WeakMap: an open-addressed hash table of keys, held weakly, and values.
+ * Keys are hashed by address, which the collector may change; #m_ld tells when
+ * it has, and the table is then rehashed. Entries whose keys die are deleted by
+ * the collector. The MPS has no ephemerons, so a value which refers to its own
+ * key keeps the entry alive.
+ */
+class WeakMap : public ObjectDesc {
+    public:
+	/** Initial number of entries; a power of two, as are all sizes. */
+	static const size_t kInitialSize = 8;
+
+	/** Weak; undefined if free, null if deleted. */
+	MemOop<WeakArray> m_keys;
+	/** The dependent of #m_keys. */
+	MemOop<WeakArray> m_values;
+	/** Entries not free, including deleted ones. */
+	size_t m_used;
+	mps_ld_s m_ld;
+
+	/** The value for \p key, or undefined. */
+	Oop get(ObjectMemoryOSThread &omemt, Oop key);
+	bool has(ObjectMemoryOSThread &omemt, Oop key);
+	void set(ObjectMemoryOSThread &omemt, Oop key, Oop val);
+	/** Delete the entry for \p key; returns whether there was one. */
+	bool remove(ObjectMemoryOSThread &omemt, Oop key);
+
+    private:
+	/** Index of \p key's entry, or of the free entry it would take. */
+	size_t probe(Oop key);
+	/**
+	 * As probe(), rehashing first if the keys may have moved; \p key is
+	 * updated should it move meanwhile.
+	 */
+	size_t find(ObjectMemoryOSThread &omemt, Oop &key);
+	/** Reinsert the entries into tables of \p size. */
+	void rehash(ObjectMemoryOSThread &omemt, size_t size);
+};
+
+/**
+ * A FinalizationRegistry. Each cell is a target, held weakly, and the value to
+ * call #m_callback with once the target has died.
+ */
+class FinalizationRegistry : public ObjectDesc {
+    public:
+	static const size_t kInitialSize = 4;
+
+	Oop m_callback;
+	/** Weak; undefined if free, null if the target has died. */
+	MemOop<WeakArray> m_targets;
+	MemOop<WeakArray> m_held;
+	/** No cell below this is free. */
+	size_t m_hint;
+
+	void add(ObjectMemoryOSThread &omemt, Oop target, Oop held);
+	/**
+	 * Queue the callback as a microtask for each cell whose target has
+	 * died, freeing the cell; returns how many.
+	 */
+	size_t cleanup(VM::Interpreter &interp);
 };
 
 struct ProperObject: public ObjectDesc {
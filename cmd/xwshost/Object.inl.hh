@@ -87,27 +87,28 @@ Oop::JS_ToNumber(ObjectMemoryOSThread &omem)
 		}
 }
 
-inline Oop&
+inline OopSlot<> *
 Environment::lookup(const char *val)
 {
-	for (size_t max = m_map->m_nLocals + m_map->m_nParams - 1;
-	     max >= m_map->m_nParams; max--) {
+	size_t nParams = m_map->m_nParams;
+
+	for (size_t max = m_map->m_nLocals + nParams; max-- > nParams;) {
 		if (!strcmp(m_map->m_names[max]->m_str, val)) {
-			printf("Resolved %s to local %lu\n", val,
-			    max);
-			return m_locals->m_elements[max];
+			xwsDbg("Resolved %s to local %lu\n", val,
+			    max - nParams);
+			return &m_locals->m_elements[max - nParams];
 		}
 	}
 
-	for (size_t max = m_map->m_nParams - 1; max >= 0; max--) {
+	for (size_t max = nParams; max-- > 0;) {
 		if (!strcmp(m_map->m_names[max]->m_str, val)) {
-			printf("Resolved %s to argument %lu\n", val,
+			xwsDbg("Resolved %s to argument %lu\n", val,
 			    max);
-			return m_args->m_elements[max];
+			return &m_args->m_elements[max];
 		}
 	}
 
-	return !m_prev.isUndefined() ? m_prev->lookup(val) : throw "Not resolved";
+	return !m_prev.get().isUndefined() ? m_prev->lookup(val) : NULL;
 }
 
 #endif /* OBJECT_INL_H_ */
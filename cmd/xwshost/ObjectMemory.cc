@@ -1,184 +1,455 @@
 #include <cassert>
+#include <cstdio>
 #include <err.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include "Object.inl.hh"
 
 #define FATAL(...) errx(EXIT_FAILURE, __VA_ARGS__)
 
-MemOop<PlainArray>
-ObjectMemoryOSThread::makeArray(size_t nElements)
+
+AllocSite::AllocSite(const char *name)
+    : m_name(name)
+    , m_id(0)
+    , m_countdown(1)
+    , m_samples(0)
+    , m_mature(0)
+    , m_diedYoung(0)
+    , m_pretenured(false)
 {
-	size_t size = ALIGN(sizeof(PlainArray) + sizeof(Oop) * nElements);
-	PlainArray *obj;
+	memset(m_samplesAsOf, 0, sizeof(m_samplesAsOf));
+}
 
-	do {
-		mps_res_t res = mps_reserve(((void **)&obj), m_mpsObjAP, size);
-		if (res != MPS_RES_OK)
-			FATAL("out of memory in makeArray");
-		obj->m_kind = ObjectDesc::kPlainArray;
-		obj->m_nElements = nElements;
-	} while (!mps_commit(m_mpsObjAP, ((void *)obj), size));
+/*
+ * Collection may move anything, so the makers keep the Oops they are given in
+ * Handles across their allocations, as any caller holding Oops across one
+ * must (see HandleScope); the literals given makeFunction() are in a vector
+ * its caller roots. An allocation made while collecting (there should be
+ * none) is not collected for again.
+ */
+void
+ObjectMemoryOSThread::emergencyCollect()
+{
+	m_inEmergency = true;
+	collect();
+	handleMessages();
+	m_inEmergency = false;
+}
 
-	return obj;
+HeapLimitResponse
+ObjectMemoryOSThread::consultHeapLimitCallback()
+{
+	GCPacer &pacer = m_omem.m_pacer;
+	size_t limit = pacer.config().m_commitLimitKB;
+
+	switch (m_heapLimitCallback ?
+	    m_heapLimitCallback(m_heapLimitData, limit) : kHeapLimitFail) {
+	case kHeapLimitRaise:
+		if (limit > pacer.config().m_commitLimitKB &&
+		    pacer.setCommitLimit(limit))
+			return kHeapLimitRaise;
+		/* fall through */
+	case kHeapLimitFail:
+		return kHeapLimitFail;
+	case kHeapLimitTerminate:
+		throw HeapExhausted(true);
+	}
+	return kHeapLimitFail;
 }
 
-PrimOop
-ObjectMemoryOSThread::makeDouble(double val)
+/*
+ * The heap is dealt with once each time its usage climbs past the mark, so
+ * that one the callback lets stay there is not collected at every poll.
+ */
+void
+ObjectMemoryOSThread::nearHeapLimit()
 {
-	PrimDesc *obj;
+	if (m_nearLimit || m_inEmergency)
+		return;
 
-	do {
-		mps_res_t res = mps_reserve(((void **)&obj), m_mpsLeafObjAP,
-		    sizeof(PrimDesc));
-		if (res != MPS_RES_OK)
-			FATAL("out of memory in makeArray");
-		obj->m_kind = PrimDesc::kDouble;
-		obj->m_dbl = val;
-	} while (!mps_commit(m_mpsLeafObjAP, ((void *)obj), sizeof(PrimDesc)));
+	emergencyCollect();
+	if (m_omem.m_pacer.nearLimit()) {
+		m_nearLimit = true;
+		consultHeapLimitCallback();
+	}
+}
 
-	return obj;
+/*
+ * Normally nearHeapLimit() will already have collected and consulted the
+ * callback, but one allocation may take the heap from below the mark to past
+ * the limit, and the callback may have let it go on to the limit.
+ */
+void
+ObjectMemoryOSThread::heapLimitReached(int tries)
+{
+	if (tries == 0 && !m_inEmergency) {
+		emergencyCollect();
+		return;
+	}
+
+	if (consultHeapLimitCallback() != kHeapLimitRaise)
+		throw HeapExhausted(false);
 }
 
 PrimOop
 ObjectMemoryOSThread::makeString(const char *txt)
 {
 	size_t len = strlen(txt);
-	size_t inlineLen = len >= 6 ? 6 : len;
-	size_t extraLen = len > 6 ? len - 6 : 0;
-	size_t size = ALIGN((sizeof(PrimDesc) + extraLen));
+	PrimDesc *obj = allocatePrim(PrimDesc::kString, len);
 
-	PrimDesc *obj;
-
-	do {
-		mps_res_t res = mps_reserve(((void **)&obj), m_mpsLeafObjAP,
-		    sizeof(PrimDesc));
-		if (res != MPS_RES_OK)
-			FATAL("out of memory in makeString");
-		obj->m_kind = PrimDesc::kString;
-		obj->m_strLen = len;
-	} while (!mps_commit(m_mpsLeafObjAP, ((void *)obj), size));
-
-	memcpy(obj->m_str, txt, inlineLen);
-	memcpy(obj->m_str + 7, txt + 7, extraLen);
+	memcpy(obj->m_str, txt, len + 1);
 
 	return PrimOop(obj, Oop::kString);
 }
 
 MemOop<CharArray>
-ObjectMemoryOSThread::makeCharArray(std::vector<char> &vec)
+ObjectMemoryOSThread::makeCharArray(std::vector<char> &vec, AllocSite *site)
 {
-	size_t size = ALIGN(sizeof(CharArray) + sizeof(char) * vec.size());
-	printf("RESULTANT SIZE: %d\n", size);
-	CharArray *obj;
-
-	do {
-		mps_res_t res = mps_reserve(((void **)&obj), m_mpsObjAP,
-		    size);
-		if (res != MPS_RES_OK)
-			FATAL("out of memory in makeCharArray");
-		obj->m_kind = ObjectDesc::kCharArray;
-		obj->m_nElements = vec.size();
-	} while (!mps_commit(m_mpsObjAP, ((void *)obj), size));
+	CharArray *obj = allocate<CharArray>(ObjectDesc::kCharArray,
+	    vec.size(), site);
 
 	memcpy(obj->m_elements, vec.data(), vec.size());
 
 	return obj;
 }
 
-MemOop<Closure>
-ObjectMemoryOSThread::makeClosure(MemOop<Function> fun, MemOop<Environment> env)
-{
-	Closure *obj;
-
-	do {
-		mps_res_t res = mps_reserve(((void **)&obj), m_mpsObjAP,
-		    ALIGN(sizeof(Closure)));
-		if (res != MPS_RES_OK)
-			FATAL("out of memory in makeClosure");
-		obj->m_kind = ObjectDesc::kClosure;
-		obj->m_func = fun;
-		obj->m_baseEnv = env;
-	} while (!mps_commit(m_mpsObjAP, ((void *)obj),
-	    ALIGN(sizeof(Closure))));
-
-	return obj;
-}
-
 MemOop<Environment>
 ObjectMemoryOSThread::makeEnvironment(MemOop<Environment> prev,
-    MemOop<EnvironmentMap> map, size_t nArgs)
-{
-	Environment *obj;
-	MemOop<PlainArray> args = makeArray(nArgs < map->m_nParams ?
-	    map->m_nParams : nArgs);
-	MemOop<PlainArray> locals = makeArray(map->m_nLocals);
-
-	do {
-		mps_res_t res = mps_reserve(((void **)&obj), m_mpsObjAP,
-		    ALIGN(sizeof(Environment)));
-		if (res != MPS_RES_OK)
-			FATAL("out of memory in makeEnvironment");
-		obj->m_kind = ObjectDesc::kEnvironment;
-		obj->m_map = map;
-		obj->m_prev = prev;
-		obj->m_args = args;
-		obj->m_locals = locals;
-		//new(obj) Environment(prev, map, args, locals);
-	} while (!mps_commit(m_mpsObjAP, ((void *)obj),
-	    ALIGN(sizeof(Environment))));
+    MemOop<EnvironmentMap> map, size_t nArgs, AllocSite *site)
+{
+	HandleScope scope(*this);
+	Handle<Environment> hPrev(*this, prev);
+	Handle<EnvironmentMap> hMap(*this, map);
+	Handle<PlainArray> args(*this, makeArray(nArgs < map->m_nParams ?
+	    map->m_nParams : nArgs, site));
+	Handle<PlainArray> locals(*this, makeArray(hMap->m_nLocals, site));
+	Environment *obj = allocate<Environment>(ObjectDesc::kEnvironment, 0,
+	    site);
+
+	obj->m_map = hMap;
+	obj->m_prev = hPrev;
+	obj->m_args = args;
+	obj->m_locals = locals;
 
 	return obj;
 }
 
 MemOop<EnvironmentMap>
 ObjectMemoryOSThread::makeEnvironmentMap(const std::vector<char *> &paramNames,
-    const std::vector<char *> &localNames)
+    const std::vector<char *> &localNames, AllocSite *site)
 {
 	size_t nParams = paramNames.size();
 	size_t nLocals = localNames.size();
-	size_t nEntries = nParams + nLocals;
-	size_t size = ALIGN(sizeof(EnvironmentMap) + sizeof(Oop) * nEntries);
-	EnvironmentMap *obj;
-
-	do {
-		mps_res_t res = mps_reserve(((void **)&obj), m_mpsObjAP, size);
-		if (res != MPS_RES_OK)
-			FATAL("out of memory in makeEnvironmentMap");
-		obj->m_kind = ObjectDesc::kEnvironmentMap;
-		obj->m_nParams = nParams;
-		obj->m_nLocals = nLocals;
-	} while (!mps_commit(m_mpsObjAP, ((void *)obj), size));
-
-	for (int i = 0; i < paramNames.size(); i++)
-		obj->m_names[i] = makeString(paramNames[i]);
-	for (int i = 0; i < localNames.size(); i++)
-		obj->m_names[nParams + i] = makeString(localNames[i]);
+	HandleScope scope(*this);
+	Handle<EnvironmentMap> map(*this,
+	    allocate<EnvironmentMap>(ObjectDesc::kEnvironmentMap,
+		sizeof(OopSlot<>) * (nParams + nLocals), site));
+
+	map->m_nParams = nParams;
+	map->m_nLocals = nLocals;
+	for (size_t i = 0; i < nParams + nLocals; i++)
+		map->m_names[i] = ObjectMemory::s_undefined;
+
+	for (int i = 0; i < paramNames.size(); i++) {
+		PrimOop name = makeString(paramNames[i]);
+		map->m_names[i] = name;
+	}
+	for (int i = 0; i < localNames.size(); i++) {
+		PrimOop name = makeString(localNames[i]);
+		map->m_names[nParams + i] = name;
+	}
 
-	return obj;
+	return map;
 }
 
 MemOop<Function>
 ObjectMemoryOSThread::makeFunction(MemOop<EnvironmentMap> map,
-    MemOop<CharArray> bytecode, MemOop<PlainArray> literals)
+    const std::vector<char> &bytecode, const std::vector<Oop> &literals,
+    MemOop<PlainArray> handlers, Function::Type type, AllocSite *site)
+{
+	size_t nLiterals = literals.size();
+	HandleScope scope(*this);
+	Handle<EnvironmentMap> hMap(*this, map);
+	Handle<PlainArray> hHandlers(*this, handlers);
+	Function *obj = allocate<Function>(ObjectDesc::kFunction,
+	    sizeof(OopSlot<>) * nLiterals + bytecode.size(), site);
+
+	obj->m_nLiterals = nLiterals;
+	obj->m_length = bytecode.size();
+	for (size_t i = 0; i < nLiterals; i++)
+		obj->m_literals[i] = literals[i];
+	if (!bytecode.empty())
+		memcpy(obj->bytecode(), &bytecode[0], bytecode.size());
+	obj->m_map = hMap;
+	obj->m_handlers = hHandlers;
+	obj->m_type = type;
+	obj->m_hotness = 0;
+	obj->m_osrEntry = -1;
+
+	return obj;
+}
+
+MemOop<NativeFunction>
+ObjectMemoryOSThread::makeNativeFunction(NativeFunction::Fn fn, void *data,
+    const char *name)
+{
+	NativeFunction *obj = allocate<NativeFunction>(
+	    ObjectDesc::kNativeFunction);
+
+	obj->m_fn = fn;
+	obj->m_data = data;
+	obj->m_name = name;
+
+	return obj;
+}
+
+/*
+ * The contents go in a leaf pool, which is never scanned; and if large, in one
+ * which never moves them, so that a large buffer costs the collector nothing.
+ */
+MemOop<ArrayBuffer>
+ObjectMemoryOSThread::makeArrayBuffer(size_t nBytes)
+{
+	HandleScope scope(*this);
+	Handle<> store(*this, allocatePrim(PrimDesc::kBytes, nBytes));
+	ArrayBuffer *obj = allocate<ArrayBuffer>(ObjectDesc::kArrayBuffer);
+
+	obj->m_store = store;
+	obj->m_external = NULL;
+	obj->m_release = NULL;
+	obj->m_byteLength = nBytes;
+
+	return obj;
+}
+
+MemOop<ArrayBuffer>
+ObjectMemoryOSThread::makeExternalArrayBuffer(void *data, size_t nBytes,
+    ArrayBuffer::Release release)
+{
+	ArrayBuffer *obj = allocate<ArrayBuffer>(ObjectDesc::kArrayBuffer);
+	mps_addr_t ref;
+
+	obj->m_store = ObjectMemory::s_undefined;
+	obj->m_external = data;
+	obj->m_release = release;
+	obj->m_byteLength = nBytes;
+
+	ref = obj;
+	if (release && mps_finalize(m_omem.arena(), &ref) != MPS_RES_OK)
+		FATAL("couldn't register ArrayBuffer for finalization");
+
+	return obj;
+}
+
+MemOop<WeakRef>
+ObjectMemoryOSThread::makeWeakRef(Oop target)
+{
+	HandleScope scope(*this);
+	Handle<> hTarget(*this, target);
+	WeakRef *obj = allocateFrom<WeakRef>(m_mpsWeakAP, ObjectDesc::kWeakRef);
+
+	obj->m_target = *hTarget;
+
+	return obj;
+}
+
+MemOop<WeakArray>
+ObjectMemoryOSThread::makeWeakArray(size_t size, bool weak)
+{
+	WeakArray *obj = allocateFrom<WeakArray>(weak ? m_mpsWeakAP :
+	    m_mpsWeakExactAP, ObjectDesc::kWeakArray, sizeof(Oop) * size);
+
+	for (size_t i = 0; i < size; i++)
+		obj->m_elements[i] = ObjectMemory::s_undefined;
+
+	return obj;
+}
+
+MemOop<WeakMap>
+ObjectMemoryOSThread::makeWeakMap()
 {
-	Function *obj;
+	HandleScope scope(*this);
+	Handle<WeakArray> keys(*this, makeWeakArray(WeakMap::kInitialSize,
+	    true));
+	Handle<WeakArray> values(*this, makeWeakArray(WeakMap::kInitialSize,
+	    false));
+	WeakMap *obj = allocateFrom<WeakMap>(m_mpsWeakExactAP,
+	    ObjectDesc::kWeakMap);
+
+	keys->m_dependent = &**values;
+	obj->m_keys = keys;
+	obj->m_values = values;
+	obj->m_used = 0;
+	mps_ld_reset(&obj->m_ld, m_omem.arena());
 
-	do {
-		mps_res_t res = mps_reserve(((void **)&obj), m_mpsObjAP,
-		    sizeof(Function));
-		if (res != MPS_RES_OK)
-			FATAL("out of memory in makeFunction");
-		obj->m_kind = ObjectDesc::kFunction;
-		obj->m_map = map;
-		obj->m_bytecode = bytecode;
-		obj->m_literals = literals;
-	} while (!mps_commit(m_mpsObjAP, ((void *)obj), sizeof(Function)));
+	return obj;
+}
+
+MemOop<FinalizationRegistry>
+ObjectMemoryOSThread::makeFinalizationRegistry(Oop callback)
+{
+	HandleScope scope(*this);
+	Handle<> hCallback(*this, callback);
+	Handle<WeakArray> targets(*this, makeWeakArray(
+	    FinalizationRegistry::kInitialSize, true));
+	Handle<WeakArray> held(*this, makeWeakArray(
+	    FinalizationRegistry::kInitialSize, false));
+	FinalizationRegistry *obj = allocateFrom<FinalizationRegistry>(
+	    m_mpsWeakExactAP, ObjectDesc::kFinalizationRegistry);
+
+	obj->m_callback = *hCallback;
+	obj->m_targets = targets;
+	obj->m_held = held;
+	obj->m_hint = 0;
 
 	return obj;
 }
 
+/*
+ * The object's header has room to spare for the site's number and the
+ * collection count; the forwarding length is only used once it is forwarded.
+ */
 void
-ObjectMemoryOSThread::poll()
+ObjectMemoryOSThread::sample(ObjectDesc *obj, AllocSite *site)
+{
+	mps_addr_t ref = obj;
+
+	if (site->m_id == 0) {
+		m_omem.m_sites.push_back(site);
+		site->m_id = m_omem.m_sites.size();
+	}
+	site->m_countdown = AllocSite::kSampleInterval;
+	if (!m_omem.m_pretenure)
+		return;
+
+	obj->m_bits = site->m_id;
+	obj->m_age = m_omem.m_epoch;
+	if (mps_finalize(m_omem.arena(), &ref) == MPS_RES_OK)
+		site->m_samples++;
+	else
+		obj->m_bits = 0;
+}
+
+/** Fewest mature samples on which to judge a site. */
+static const uint64_t kMinSamples = 16;
+/** Mature samples beyond which a site's counts are halved, to adapt. */
+static const uint64_t kMaxSamples = 1024;
+/** Survival at or above which to pretenure a site... */
+static const double kPretenureSurvival = 0.8;
+/** ...and below which to stop. */
+static const double kTenureSurvival = 0.5;
+
+void
+ObjectMemory::sampleDied(ObjectDesc *obj)
+{
+	AllocSite *site = m_sites[obj->m_bits - 1];
+
+	/* an object 256 collections old may pass for young; that is rare */
+	if ((uint8_t)(m_epoch - obj->m_age) <= AllocSite::kYoungAge)
+		site->m_diedYoung++;
+	obj->m_bits = 0;
+}
+
+/*
+ * A sample is mature once kYoungAge collections have finished since it was
+ * made; the count of samples as of each of the last kYoungAge collections is
+ * kept so as to know how many are.
+ */
+void
+ObjectMemory::updateSites()
+{
+	m_epoch++;
+
+	for (size_t i = 0; i < m_sites.size(); i++) {
+		AllocSite *site = m_sites[i];
+		uint64_t &asOf = site->m_samplesAsOf[m_epoch %
+		    AllocSite::kYoungAge];
+		double survival;
+
+		site->m_mature = asOf;
+		asOf = site->m_samples;
+		if (site->m_mature < kMinSamples)
+			continue;
+
+		survival = site->m_diedYoung >= site->m_mature ? 0 :
+		    1 - (double)site->m_diedYoung / site->m_mature;
+		if (!site->m_pretenured && survival >= kPretenureSurvival)
+			site->m_pretenured = true;
+		else if (site->m_pretenured && survival < kTenureSurvival)
+			site->m_pretenured = false;
+
+		if (site->m_mature >= kMaxSamples) {
+			site->m_samples /= 2;
+			for (size_t j = 0; j < AllocSite::kYoungAge; j++)
+				site->m_samplesAsOf[j] /= 2;
+			site->m_mature /= 2;
+			site->m_diedYoung /= 2;
+		}
+	}
+}
+
+std::string
+ObjectMemory::allocSitesJSON() const
+{
+	std::string json("[");
+	char buf[160];
+
+	for (size_t i = 0; i < m_sites.size(); i++) {
+		AllocSite *site = m_sites[i];
+
+		snprintf(buf, sizeof(buf),
+		    "%s{\"name\":\"%s\",\"samples\":%llu,\"mature\":%llu,"
+		    "\"diedYoung\":%llu,\"pretenured\":%s}",
+		    i ? "," : "", site->m_name,
+		    (unsigned long long)site->m_samples,
+		    (unsigned long long)site->m_mature,
+		    (unsigned long long)site->m_diedYoung,
+		    site->m_pretenured ? "true" : "false");
+		json += buf;
+	}
+	json += "]";
+
+	return json;
+}
+
+void
+ObjectMemoryOSThread::countLarge(size_t size)
+{
+	int cls = 0;
+
+	while (cls < kLargeClasses - 1 &&
+	    size >= m_omem.m_largeSize << (cls + 1))
+		cls++;
+	m_largeCount[cls]++;
+	m_largeBytes[cls] += size;
+}
+
+std::string
+ObjectMemoryOSThread::largeObjectsJSON()
+{
+	std::string json;
+	char buf[96];
+
+	snprintf(buf, sizeof(buf), "{\"total\":%llu,\"free\":%llu,"
+	    "\"classes\":[", (unsigned long long)m_omem.largeObjectsTotal(),
+	    (unsigned long long)m_omem.largeObjectsFree());
+	json = buf;
+	for (int i = 0; i < kLargeClasses; i++) {
+		snprintf(buf, sizeof(buf),
+		    "%s{\"minBytes\":%llu,\"count\":%llu,\"bytes\":%llu}",
+		    i ? "," : "", (unsigned long long)m_omem.m_largeSize << i,
+		    (unsigned long long)m_largeCount[i],
+		    (unsigned long long)m_largeBytes[i]);
+		json += buf;
+	}
+	json += "]}";
+
+	return json;
+}
+
+void
+ObjectMemoryOSThread::handleMessages()
 {
 	mps_message_type_t type;
 	mps_arena_t arena = m_omem.arena();
@@ -190,11 +461,14 @@ ObjectMemoryOSThread::poll()
 		assert(b); /* we just checked there was one */
 
 		if (type == mps_message_type_gc_start()) {
-			printf("Collection started.\n");
-			printf("  Why: %s\n",
-			    mps_message_gc_start_why(arena, message));
-			printf("  Clock: %lu\n",
-			    (unsigned long)mps_message_clock(arena, message));
+			const char *why = mps_message_gc_start_why(arena,
+			    message);
+			mps_clock_t clock = mps_message_clock(arena, message);
+
+			m_omem.m_telemetry.recordStart(why, clock);
+			xwsDbg("Collection started.\n");
+			xwsDbg("  Why: %s\n", why);
+			xwsDbg("  Clock: %lu\n", (unsigned long)clock);
 
 		} else if (type == mps_message_type_gc()) {
 			size_t live = mps_message_gc_live_size(arena, message);
@@ -202,21 +476,43 @@ ObjectMemoryOSThread::poll()
 			    message);
 			size_t not_condemned =
 			    mps_message_gc_not_condemned_size(arena, message);
-			printf("Collection finished.\n");
-			printf("    live %lu\n", (unsigned long)live);
-			printf("    condemned %lu\n", (unsigned long)condemned);
-			printf("    not_condemned %lu\n",
+			mps_clock_t clock = mps_message_clock(arena, message);
+
+			m_omem.m_telemetry.recordFinish(clock, condemned, live,
+			    not_condemned);
+			m_omem.m_pacer.collected(m_omem.m_telemetry.cause(),
+			    m_bytesAllocated, condemned, live);
+			m_omem.updateSites();
+			xwsDbg("Collection finished.\n");
+			xwsDbg("    live %lu\n", (unsigned long)live);
+			xwsDbg("    condemned %lu\n", (unsigned long)condemned);
+			xwsDbg("    not_condemned %lu\n",
 			    (unsigned long)not_condemned);
-			printf("    clock: %lu\n",
-			    (unsigned long)mps_message_clock(arena, message));
+			xwsDbg("    clock: %lu\n", (unsigned long)clock);
 
 		} else if (type == mps_message_type_finalization()) {
-#if 0
-			mps_addr_t port_ref;
-			obj_t port;
-			mps_message_finalization_ref(&port_ref, arena, message);
-			port = port_ref;
-#endif
+			/*
+			 * The message keeps the object alive until discarded,
+			 * so it is safe to look at; and if it is reachable
+			 * again after that, it must not be released twice.
+			 */
+			mps_addr_t ref;
+			ObjectDesc *obj;
+
+			mps_message_finalization_ref(&ref, arena, message);
+			obj = (ObjectDesc *)ref;
+
+			/* sampled objects are never external ArrayBuffers */
+			if (obj->m_bits)
+				m_omem.sampleDied(obj);
+			else if (obj->m_kind == ObjectDesc::kArrayBuffer) {
+				ArrayBuffer *buf = (ArrayBuffer *)obj;
+
+				buf->m_release(buf->m_external,
+				    buf->m_byteLength);
+				buf->m_external = NULL;
+				buf->m_byteLength = 0;
+			}
 
 		} else {
 			printf("Unknown message from MPS!\n");
@@ -226,3 +522,75 @@ ObjectMemoryOSThread::poll()
 		mps_message_discard(arena, message);
 	}
 }
+
+void
+ObjectMemoryOSThread::poll()
+{
+	handleMessages();
+	if (!m_omem.m_pacer.nearLimit())
+		m_nearLimit = false;
+	else
+		nearHeapLimit();
+	m_omem.m_pacer.pace(m_bytesAllocated);
+	if (m_omem.m_hugePages)
+		adviseHugePages();
+}
+
+/*
+ * The MPS maps memory as it commits it, and so gives each commitment a fresh
+ * mapping without the advice; nor does it say when it commits. The page an AP
+ * is allocating in is taken instead as a sign of a new commitment, and checked
+ * at each poll: that is early enough for most of a nursery's pages to be
+ * faulted in as huge pages, and otherwise khugepaged collapses them later.
+ * With the arena's grain a huge page, the page is wholly in one segment.
+ */
+void
+ObjectMemoryOSThread::adviseHugePages()
+{
+#ifdef MADV_HUGEPAGE
+	mps_ap_t aps[kAdvisedAPs] = { m_mpsObjAP, m_mpsLeafObjAP,
+		m_mpsOldObjAP, m_mpsLargeObjAP, m_mpsLargeLeafObjAP };
+
+	for (int i = 0; i < kAdvisedAPs; i++) {
+		uintptr_t page = (uintptr_t)aps[i]->init &
+		    ~(uintptr_t)(ObjectMemory::kHugePage - 1);
+
+		if (page == 0 || page == m_advisedPages[i])
+			continue;
+		madvise((void *)page, ObjectMemory::kHugePage, MADV_HUGEPAGE);
+		m_advisedPages[i] = page;
+	}
+#endif
+}
+
+bool
+ObjectMemoryOSThread::idle(uint64_t deadlineMicros)
+{
+	struct timespec ts;
+	uint64_t now;
+	bool more;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	handleMessages();
+	more = m_omem.m_pacer.idle(now < deadlineMicros ?
+	    (deadlineMicros - now) / 1e6 : 0);
+	handleMessages();
+
+	return more;
+}
+
+void
+ObjectMemoryOSThread::collect()
+{
+	m_omem.m_pacer.collect(m_bytesAllocated);
+}
+
+void
+ObjectMemoryOSThread::setHeapLimitCallback(HeapLimitCallback callback,
+    void *data)
+{
+	m_heapLimitCallback = callback;
+	m_heapLimitData = data;
+}
@@ -1,13 +1,62 @@
 #ifndef OBJECTMEMORY_HH_
 #define OBJECTMEMORY_HH_
 
+#include <cstring>
 #include <vector>
 
+#include "GCPacer.hh"
+#include "GCTelemetry.hh"
 #include "Object.h"
 
+/* no less, as an Oop tags a pointer in its low 4 bits */
 #define ALIGNMENT 16
 #define ALIGN(size) (((size) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
 
+/**
+ * A place in the runtime from which objects are allocated, for pretenuring.
+ *
+ * One in kSampleInterval of the ObjectDescs allocated from a site is sampled:
+ * it is marked with the site and the collection count, and registered for
+ * finalization so that the collector reports its death. A site most of whose
+ * samples outlive kYoungAge collections is pretenured, its objects thereafter
+ * going straight to the second generation instead of being copied out of the
+ * nursery; should most then die young after all, it is tenured no longer.
+ */
+struct AllocSite {
+	static const uint32_t kSampleInterval = 64;
+	static const uint32_t kYoungAge = 2;
+
+	const char *m_name;
+	/** 1 + index in ObjectMemory's sites; 0 until first sampled. */
+	uint16_t m_id;
+	/** Allocations until the next sample. */
+	uint32_t m_countdown;
+	/** Samples to date, and as of the last kYoungAge collections. */
+	uint64_t m_samples;
+	uint64_t m_samplesAsOf[kYoungAge];
+	/** Samples old enough to have died young, and those that did. */
+	uint64_t m_mature;
+	uint64_t m_diedYoung;
+	bool m_pretenured;
+
+	AllocSite(const char *name);
+};
+
+/**
+ * The heap. Objects are allocated in the copying pools, except that those of
+ * HeapConfig::m_largeObjectKB or more go to pools which never move them, and
+ * are only marked and swept; copying them would cost more than their
+ * fragmenting the heap does.
+ *
+ * Code (functions, which hold their bytecode and literals, and their
+ * environment maps and handler tables) goes instead to the code space: a pair
+ * of non-moving pools on a chain of their own, whose one generation is
+ * collected only once a good deal of code has been made. Code never moves, so
+ * the interpreter may hold raw pointers into it; see CodeScope.
+ *
+ * Weak objects and the tables that refer to them go in the AWL pool, allocated
+ * with weak or exact rank as they hold their referents weakly or not.
+ */
 class ObjectMemory {
 	friend class ObjectMemoryOSThread;
 
@@ -27,51 +76,563 @@ class ObjectMemory {
 	mps_pool_t m_mpsObjDescPool;
 	/** AMCZ pool for PrimDescs. */
 	mps_pool_t m_mpsPrimDescPool;
+	/** AMC pool for ObjectDescs from pretenured sites. */
+	mps_pool_t m_mpsOldObjDescPool;
+	/** AMS pool for large ObjectDescs. */
+	mps_pool_t m_mpsLargeObjDescPool;
+	/** LO pool for large PrimDescs. */
+	mps_pool_t m_mpsLargePrimDescPool;
+	/** AWL pool for weak objects. */
+	mps_pool_t m_mpsWeakPool;
+	/** The code space's chain, and its AMS and LO pools. */
+	mps_chain_t m_mpsCodeChain;
+	mps_pool_t m_mpsCodeObjDescPool;
+	mps_pool_t m_mpsCodePrimDescPool;
+	/** Size at and above which an object is large. */
+	size_t m_largeSize;
+
+	/** Whether to use transparent huge pages; see HeapConfig. */
+	bool m_hugePages;
+	/** Whether sites may be pretenured. */
+	bool m_pretenure;
+	std::vector<AllocSite *> m_sites;
+	/** Collections finished to date. */
+	uint32_t m_epoch;
+
+	void sampleDied(ObjectDesc *obj);
+	/** Note the end of a collection, pretenuring sites as due. */
+	void updateSites();
+
+	GCTelemetry m_telemetry;
+	GCPacer m_pacer;
 
     public:
 	static PrimOop s_undefined, s_null, s_true, s_false;
+	static const size_t kHugePage = HeapConfig::kHugePageKB * 1024;
 
-	ObjectMemory();
+	ObjectMemory(const HeapConfig &config = HeapConfig());
 
 	inline mps_arena_t & arena() { return m_mpsArena; }
+	inline GCTelemetry & telemetry() { return m_telemetry; }
+	inline GCPacer & pacer() { return m_pacer; }
+	/** Collections finished to date. */
+	inline uint32_t epoch() const { return m_epoch; }
+
+	/** Bytes in the large object pools, and how many of those are free. */
+	size_t largeObjectsTotal();
+	size_t largeObjectsFree();
+	/** The allocation sites' samples and state, as a JSON array. */
+	std::string allocSitesJSON() const;
+};
+
+/**
+ * Thrown out of an allocation which cannot be made within the heap limit
+ * (HeapConfig::m_commitLimitKB) even after an emergency collection and the
+ * HeapLimitCallback's say, or, to terminate the script, out of a poll near
+ * the limit. The interpreter raises it in the script as a RangeError, or if
+ * #m_terminate terminates the script.
+ */
+struct HeapExhausted {
+	bool m_terminate;
+
+	HeapExhausted(bool terminate)
+	    : m_terminate(terminate) {};
 };
 
+/** What is to be done about an allocation beyond the heap limit. */
+enum HeapLimitResponse {
+	kHeapLimitRaise,     /**< retry it, the limit having been raised */
+	kHeapLimitFail,	     /**< fail it, with HeapExhausted */
+	kHeapLimitTerminate, /**< fail it, terminating the script */
+};
+
+/**
+ * Asked what to do when usage of the heap nears its limit of \p limitKB
+ * (see GCPacer::nearLimit()) even after a full collection, and again when an
+ * allocation would exceed it. To let the script go on, raise \p limitKB and
+ * return kHeapLimitRaise; near the limit, kHeapLimitFail lets it go on until
+ * an allocation fails.
+ */
+typedef HeapLimitResponse (*HeapLimitCallback)(void *data, size_t &limitKB);
+
 /**
  * Per OS thread ObjectMemory.
  */
 class ObjectMemoryOSThread {
+	friend class CodeScope;
+	friend class HandleScope;
+	template <class T> friend class Handle;
+
+	static const int kLargeClasses = 8;
+	/** APs whose pages are madvise()d under HeapConfig::m_hugePages. */
+	static const int kAdvisedAPs = 5;
+
 	ObjectMemory &m_omem;
 	/** Allocation point for regular objects. */
 	mps_ap_t m_mpsObjAP;
 	/** Allocation point for leaf objects. */
 	mps_ap_t m_mpsLeafObjAP;
+	/** Allocation point for regular objects from pretenured sites. */
+	mps_ap_t m_mpsOldObjAP;
+	/** Allocation points for large regular and leaf objects. */
+	mps_ap_t m_mpsLargeObjAP;
+	mps_ap_t m_mpsLargeLeafObjAP;
+	/** Allocation points for weak and strong objects in the AWL pool. */
+	mps_ap_t m_mpsWeakAP;
+	mps_ap_t m_mpsWeakExactAP;
+	/** Allocation points for the code space. */
+	mps_ap_t m_mpsCodeObjAP;
+	mps_ap_t m_mpsCodeLeafObjAP;
+	/** Depth of CodeScopes; if nonzero, all allocation is of code. */
+	int m_codeDepth;
+#ifdef XWS_CONSERVATIVE_STACK
 	/** Root for this thread's stack */
 	mps_root_t m_mpsThreadRoot;
+#endif
+	/** The Oops of this thread's Handles, innermost scope last. */
+	std::vector<Oop> m_handles;
+	mps_root_t m_mpsHandlesRoot;
 	/** MPS thread representation. */
 	mps_thr_t m_mpsThread;
+	/** Bytes allocated by this thread to date. */
+	uint64_t m_bytesAllocated;
+	/**
+	 * Large objects allocated by this thread to date, by size class:
+	 * class i holds those of at least 2^i times the large object size.
+	 */
+	uint64_t m_largeCount[kLargeClasses];
+	uint64_t m_largeBytes[kLargeClasses];
+	HeapLimitCallback m_heapLimitCallback;
+	void *m_heapLimitData;
+	/** Whether an emergency collection is under way. */
+	bool m_inEmergency;
+	/**
+	 * Whether the heap has been near its limit since it was last dealt
+	 * with there; see nearHeapLimit().
+	 */
+	bool m_nearLimit;
+	/** The huge page each advised AP was last found allocating in. */
+	uintptr_t m_advisedPages[kAdvisedAPs];
+
+	void handleMessages();
+	/**
+	 * Advise the kernel to back with a huge page the page each AP is
+	 * allocating in, if that has changed.
+	 */
+	void adviseHugePages();
+	void countLarge(size_t size);
+	void sample(ObjectDesc *obj, AllocSite *site);
+	/** Collect the whole heap, and handle the messages that results in. */
+	void emergencyCollect();
+	/**
+	 * Consult the HeapLimitCallback, raising the limit if it says to.
+	 * Throws HeapExhausted if it says to terminate the script.
+	 */
+	HeapLimitResponse consultHeapLimitCallback();
+	/**
+	 * Called by poll() while the heap is near its limit: the first time,
+	 * collect the whole heap, then, if still near, consult the
+	 * HeapLimitCallback.
+	 */
+	void nearHeapLimit();
+	/**
+	 * Called when a reservation fails, for the \p tries'th time for the
+	 * same object: the first time, collect the whole heap; after that,
+	 * consult the HeapLimitCallback. Returns if the reservation should be
+	 * retried, and otherwise throws HeapExhausted.
+	 */
+	void heapLimitReached(int tries);
+
+	/**
+	 * The allocation point for regular objects of \p size bytes from
+	 * \p site, if any.
+	 */
+	inline mps_ap_t objAP(size_t size, AllocSite *site = NULL)
+	{
+		if (m_codeDepth)
+			return m_mpsCodeObjAP;
+		if (size < m_omem.m_largeSize)
+			return site && site->m_pretenured ? m_mpsOldObjAP :
+			    m_mpsObjAP;
+		countLarge(size);
+		return m_mpsLargeObjAP;
+	}
+	/** The allocation point for leaf objects of \p size bytes. */
+	inline mps_ap_t leafAP(size_t size)
+	{
+		if (m_codeDepth)
+			return m_mpsCodeLeafObjAP;
+		if (size < m_omem.m_largeSize)
+			return m_mpsLeafObjAP;
+		countLarge(size);
+		return m_mpsLargeLeafObjAP;
+	}
 
     public:
+	/**
+	 * \p marker is the cold end of the thread's stack, which is scanned
+	 * only if built with XWS_CONSERVATIVE_STACK.
+	 */
 	ObjectMemoryOSThread(ObjectMemory &omem, void *marker);
 
-	MemOop<PlainArray> makeArray(size_t size);
-	PrimOop makeDouble(double val);
+	/**
+	 * Allocate an ObjectDesc of type \p T and kind \p kind, with \p extra
+	 * bytes following it, from \p site if any. Its fields are zeroed,
+	 * and its length set to cover the extra bytes (see setExtent()), so
+	 * the caller need only fill it in.
+	 */
+	template <class T>
+	inline T *allocate(ObjectDesc::Kind kind, size_t extra = 0,
+	    AllocSite *site = NULL);
+	/** As allocate(), but from allocation point \p ap. */
+	template <class T>
+	inline T *allocateFrom(mps_ap_t ap, ObjectDesc::Kind kind,
+	    size_t extra = 0);
+	/**
+	 * Allocate a PrimDesc of kind \p kind; \p len is the length of a
+	 * string or byte store.
+	 */
+	inline PrimDesc *allocatePrim(PrimDesc::Kind kind, size_t len = 0);
+
+	/* the commonest are inline, below */
+	inline MemOop<PlainArray> makeArray(size_t size,
+	    AllocSite *site = NULL);
+	inline PrimOop makeDouble(double val);
 	PrimOop makeString(const char *txt);
-	MemOop<CharArray> makeCharArray(std::vector<char> &vec);
-	MemOop<Closure> makeClosure(MemOop<Function> fun, MemOop<Environment> env);
+	MemOop<CharArray> makeCharArray(std::vector<char> &vec,
+	    AllocSite *site = NULL);
+	inline MemOop<Closure> makeClosure(MemOop<Function> fun,
+	    MemOop<Environment> env, AllocSite *site = NULL);
 	MemOop<Environment> makeEnvironment(MemOop<Environment> prev,
-	    MemOop<EnvironmentMap> map, size_t nArgs);
+	    MemOop<EnvironmentMap> map, size_t nArgs, AllocSite *site = NULL);
 	MemOop<EnvironmentMap>
 	makeEnvironmentMap(const std::vector<char *> &paramNames,
-	    const std::vector<char *> &localNames);
+	    const std::vector<char *> &localNames, AllocSite *site = NULL);
 	MemOop<Function> makeFunction(MemOop<EnvironmentMap> map,
-	    MemOop<CharArray> bytecode, MemOop<PlainArray> literals);
+	    const std::vector<char> &bytecode, const std::vector<Oop> &literals,
+	    MemOop<PlainArray> handlers, Function::Type type,
+	    AllocSite *site = NULL);
+	inline MemOop<Activation> makeActivation(MemOop<Closure> closure,
+	    MemOop<Environment> env, AllocSite *site = NULL);
+	inline MemOop<Promise> makePromise(AllocSite *site = NULL);
+	MemOop<NativeFunction> makeNativeFunction(NativeFunction::Fn fn,
+	    void *data, const char *name);
+	/** Make an ArrayBuffer of \p nBytes bytes, which are not cleared. */
+	MemOop<ArrayBuffer> makeArrayBuffer(size_t nBytes);
+	/**
+	 * Make an ArrayBuffer of the \p nBytes bytes at \p data, which are
+	 * passed to \p release once it is unreachable.
+	 */
+	MemOop<ArrayBuffer> makeExternalArrayBuffer(void *data, size_t nBytes,
+	    ArrayBuffer::Release release);
+	MemOop<WeakRef> makeWeakRef(Oop target);
+	/** Make a WeakArray of undefined, with weak rank if \p weak. */
+	MemOop<WeakArray> makeWeakArray(size_t size, bool weak);
+	MemOop<WeakMap> makeWeakMap();
+	MemOop<FinalizationRegistry> makeFinalizationRegistry(Oop callback);
 
+	/**
+	 * Handle messages from the collector, deal with the heap if it is
+	 * near its limit, then start or advance a collection if the pacer
+	 * finds one due. May throw HeapExhausted; see HeapLimitCallback.
+	 */
 	void poll();
+	/** Collect the whole heap now. */
+	void collect();
+	/**
+	 * Collect the whole heap, then write a snapshot of it to \p path; see
+	 * HeapSnapshot.hh. Returns false, with errno set, if it could not be
+	 * written.
+	 */
+	bool writeHeapSnapshot(const char *path);
+	/**
+	 * Have \p callback, with \p data, decide what to do when the heap
+	 * limit is reached; see HeapLimitCallback. Without one, allocations
+	 * beyond it fail.
+	 */
+	void setHeapLimitCallback(HeapLimitCallback callback, void *data);
+	/**
+	 * Do collection work until \p deadlineMicros, a CLOCK_MONOTONIC
+	 * time in us, for embedders to call when they expect to be idle
+	 * until then. Returns whether there is more to do.
+	 */
+	bool idle(uint64_t deadlineMicros);
 
 	inline ObjectMemory & omem() { return m_omem; }
+	inline uint64_t bytesAllocated() const { return m_bytesAllocated; }
+	/**
+	 * The large object pools' occupancy and this thread's allocations in
+	 * each size class, as a JSON object.
+	 */
+	std::string largeObjectsJSON();
+};
+
+/**
+ * Everything which may allocate, and every safepoint, may move any object.
+ * Native code which holds an Oop across one therefore keeps it in a Handle,
+ * through which the collector finds and updates it; a HandleScope releases
+ * the Handles made within it when it ends. Oops in the interpreter's stack
+ * and other long-lived vectors are instead registered as roots of their own.
+ */
+class HandleScope {
+	ObjectMemoryOSThread &m_omemt;
+	size_t m_base;
+
+    public:
+	HandleScope(ObjectMemoryOSThread &omemt)
+	    : m_omemt(omemt)
+	    , m_base(omemt.m_handles.size()) {};
+	~HandleScope()
+	{
+		m_omemt.m_handles.erase(m_omemt.m_handles.begin() + m_base,
+		    m_omemt.m_handles.end());
+	}
+};
+
+/**
+ * Within a CodeScope, everything allocated goes to the code space. The
+ * bytecode encoder makes functions and their literals within one.
+ */
+class CodeScope {
+	ObjectMemoryOSThread &m_omemt;
+
+    public:
+	CodeScope(ObjectMemoryOSThread &omemt)
+	    : m_omemt(omemt)
+	{
+		m_omemt.m_codeDepth++;
+	}
+	~CodeScope() { m_omemt.m_codeDepth--; }
+};
+
+/**
+ * A Handle may be copied, the copy referring to the same slot. References
+ * got through it are good only until the next Handle is made.
+ */
+template <class T = PrimDesc> class Handle {
+	ObjectMemoryOSThread *m_omemt;
+	size_t m_idx;
+
+    public:
+	Handle(ObjectMemoryOSThread &omemt, Oop oop)
+	    : m_omemt(&omemt)
+	    , m_idx(omemt.m_handles.size())
+	{
+		omemt.m_handles.push_back(oop);
+	}
+
+	inline MemOop<T> &operator*() const
+	{
+		return *(MemOop<T> *)&m_omemt->m_handles[m_idx];
+	}
+	inline T *operator->() const { return (**this).operator->(); }
+	inline operator MemOop<T>() const { return **this; }
+
+	inline Handle &operator=(Oop oop)
+	{
+		m_omemt->m_handles[m_idx] = oop;
+		return *this;
+	}
 };
 
+/*
+ * Set the length of an ObjectDesc allocated with \p extra bytes following it,
+ * which is all the collector needs to skip it. An EnvironmentMap is given only
+ * params; the caller may then divide them between params and locals.
+ */
+inline void
+setExtent(ObjectDesc *, size_t)
+{
+}
+
+inline void
+setExtent(PlainArray *obj, size_t extra)
+{
+	obj->m_length = extra / sizeof(OopSlot<>);
+}
+
+inline void
+setExtent(CharArray *obj, size_t extra)
+{
+	obj->m_length = extra;
+}
+
+inline void
+setExtent(EnvironmentMap *obj, size_t extra)
+{
+	obj->m_nParams = extra / sizeof(OopSlot<>);
+}
+
+/* given only bytecode; makeFunction() divides it with the literals */
+inline void
+setExtent(Function *obj, size_t extra)
+{
+	obj->m_length = extra;
+}
+
+inline void
+setExtent(WeakArray *obj, size_t extra)
+{
+	obj->m_length = extra / sizeof(Oop);
+}
+
+/*
+ * Fields are zeroed within the reserve/commit loop, so that the object is
+ * well-formed when committed; a zero Oop is a pointer outside the arena.
+ */
+template <class T>
+inline T *
+ObjectMemoryOSThread::allocateFrom(mps_ap_t ap, ObjectDesc::Kind kind,
+    size_t extra)
+{
+	size_t size = ALIGN(sizeof(T) + extra);
+	T *obj;
+
+	do {
+		int tries = 0;
+
+		while (mps_reserve((mps_addr_t *)&obj, ap, size) != MPS_RES_OK)
+			heapLimitReached(tries++);
+		memset((void *)obj, 0, size);
+		obj->m_kind = kind;
+		setExtent(obj, extra);
+	} while (!mps_commit(ap, (mps_addr_t)obj, size));
+	m_bytesAllocated += size;
+
+	return obj;
+}
+
+template <class T>
+inline T *
+ObjectMemoryOSThread::allocate(ObjectDesc::Kind kind, size_t extra,
+    AllocSite *site)
+{
+	T *obj = allocateFrom<T>(objAP(ALIGN(sizeof(T) + extra), site), kind,
+	    extra);
+
+	if (site && --site->m_countdown == 0)
+		sample(obj, site);
+
+	return obj;
+}
+
+inline PrimDesc *
+ObjectMemoryOSThread::allocatePrim(PrimDesc::Kind kind, size_t len)
+{
+	size_t size;
+	mps_ap_t ap;
+	PrimDesc *obj;
+
+	if (kind == PrimDesc::kString || kind == PrimDesc::kSymbol)
+		/* the first 7 bytes, NUL included, are in the header */
+		size = ALIGN(sizeof(PrimDesc) + (len > 6 ? len - 6 : 0));
+	else if (kind == PrimDesc::kBytes)
+		size = ALIGN(sizeof(PrimDesc) + len);
+	else
+		size = sizeof(PrimDesc);
+	ap = leafAP(size);
+
+	do {
+		int tries = 0;
+
+		while (mps_reserve((mps_addr_t *)&obj, ap, size) != MPS_RES_OK)
+			heapLimitReached(tries++);
+		obj->m_kind = kind;
+		obj->m_strLen = len;
+	} while (!mps_commit(ap, (mps_addr_t)obj, size));
+	m_bytesAllocated += size;
+
+	return obj;
+}
+
+inline MemOop<PlainArray>
+ObjectMemoryOSThread::makeArray(size_t nElements, AllocSite *site)
+{
+	PlainArray *obj = allocate<PlainArray>(ObjectDesc::kPlainArray,
+	    sizeof(OopSlot<>) * nElements, site);
+
+	for (size_t i = 0; i < nElements; i++)
+		obj->m_elements[i] = ObjectMemory::s_undefined;
+	return obj;
+}
+
+inline PrimOop
+ObjectMemoryOSThread::makeDouble(double val)
+{
+	PrimDesc *obj = allocatePrim(PrimDesc::kDouble);
+
+	obj->m_dbl = val;
+	return obj;
+}
+
+inline MemOop<Closure>
+ObjectMemoryOSThread::makeClosure(MemOop<Function> fun,
+    MemOop<Environment> env, AllocSite *site)
+{
+	HandleScope scope(*this);
+	Handle<Function> hFun(*this, fun);
+	Handle<Environment> hEnv(*this, env);
+	Closure *obj = allocate<Closure>(ObjectDesc::kClosure, 0, site);
+
+	obj->m_func = hFun;
+	obj->m_baseEnv = hEnv;
+	obj->m_code = hFun->bytecode();
+	return obj;
+}
+
+inline MemOop<Activation>
+ObjectMemoryOSThread::makeActivation(MemOop<Closure> closure,
+    MemOop<Environment> env, AllocSite *site)
+{
+	HandleScope scope(*this);
+	Handle<Closure> hClosure(*this, closure);
+	Handle<Environment> hEnv(*this, env);
+	Activation *obj = allocate<Activation>(ObjectDesc::kActivation, 0,
+	    site);
+
+	obj->m_closure = hClosure;
+	obj->m_env = hEnv;
+	obj->m_promise = *(MemOop<Promise> *)&ObjectMemory::s_undefined;
+	obj->m_slots = *(MemOop<PlainArray> *)&ObjectMemory::s_undefined;
+	obj->m_result = ObjectMemory::s_undefined;
+	obj->m_pc = 0;
+	obj->m_nSlots = 0;
+	obj->m_state = Activation::kStart;
+	return obj;
+}
+
+inline MemOop<Promise>
+ObjectMemoryOSThread::makePromise(AllocSite *site)
+{
+	Promise *obj = allocate<Promise>(ObjectDesc::kPromise, 0, site);
+
+	obj->m_reaction = ObjectMemory::s_undefined;
+	obj->m_reactions = *(MemOop<PlainArray> *)&ObjectMemory::s_undefined;
+	obj->m_result = ObjectMemory::s_undefined;
+	obj->m_nReactions = 0;
+	obj->m_state = Promise::kPending;
+	return obj;
+}
+
 mps_res_t
 scanOopVec(mps_ss_t ss, void *p, size_t s);
+/**
+ * Scan a std::vector<Oop> registered with weak rank; elements whose referents
+ * have died become undefined.
+ */
+mps_res_t
+scanWeakOopVec(mps_ss_t ss, void *p, size_t s);
+/**
+ * Scan the Oops between \p base and \p limit; for exact and ambiguous roots
+ * alike.
+ */
+mps_res_t
+scanOopArea(mps_ss_t ss, void *base, void *limit, void *closure);
+/**
+ * Scan a std::vector<void *> of object addresses; registered with an ambiguous
+ * rank, this pins them.
+ */
+mps_res_t
+scanPinnedVec(mps_ss_t ss, void *p, size_t s);
 
 #endif /* OBJECTMEMORY_HH_ */
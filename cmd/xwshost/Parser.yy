@@ -119,6 +119,11 @@ jslex(JSSTYPE *yylval, JSLTYPE *loc, Driver * driver);
 	std::vector<StmtNode*> *stmtNodeVec;
 	std::vector<ExprNode*> *exprNodeVec;
 	std::vector<SingleDeclNode*> *singleDeclNodeVec;
+
+	struct {
+		DestructuringNode *param; /* may be NULL */
+		StmtNode *block;
+	} catchClause;
 }
 
 %type <str> IDENTIFIER IdentifierNotReserved
@@ -135,7 +140,7 @@ jslex(JSSTYPE *yylval, JSLTYPE *loc, Driver * driver);
 %type <exprNode> PrimaryExpr PrimaryExpr_NoBrace
 %type <exprNode> Literal
 
-%type <exprNode> ArrowFunction
+%type <exprNode> ArrowFunction AsyncArrowFunction
 %type <destructuringNodeVec> ArrowParameters
 %type <coverParenthesisedExprAndArrowParameterListNode>
     CoverParenthesisedExprAndArrowParameterList
@@ -169,15 +174,20 @@ jslex(JSSTYPE *yylval, JSLTYPE *loc, Driver * driver);
 %type <exprNode> ConditionalExpr ConditionalExpr_NoBrace
 %type <exprNode> AssignmentExpr AssignmentExpr_NoBrace
 %type <exprNode> Expr Expr_NoBrace ExprOpt
+%type <exprNode> YieldExpr AwaitExpr
 
 %type <stmtNode> Block BlockStmt VariableStmt EmptyStmt
 %type <stmtNode> ExprStmt IfStmt BreakableStmt
 %type <stmtNode> ContinueStmt BreakStmt ReturnStmt WithStmt
 %type <stmtNode> LabelledStmt ThrowStmt TryStmt DebuggerStmt
-%type <stmtNode> IterationStmt DoWhileStmt WhileStmt ForStmt
+%type <stmtNode> IterationStmt DoWhileStmt WhileStmt ForStmt ForInOfStmt
+%type <destructuringNode> ForBinding
 %type <stmtNode> Stmt LabelledItem StmtListItem
 
 %type <destructuringNode> BindingElement BindingRestElement SingleNameBinding
+%type <destructuringNode> CatchParameter
+%type <catchClause> Catch
+%type <stmtNode> Finally
 
 %type <destructuringNodeVec> UniqueFormalParameters FormalParameters
 %type <destructuringNodeVec> FormalParameterList
@@ -187,7 +197,7 @@ jslex(JSSTYPE *yylval, JSLTYPE *loc, Driver * driver);
 
 %type <stmtNodeVec> StmtList ScriptBody
 
-%type <exprNode> FunctionExpr
+%type <exprNode> FunctionExpr GeneratorExpr AsyncFunctionExpr
 %type <stmtNodeVec> FunctionBody FunctionStmtList
 
 %type <intVal> LetOrConst
@@ -248,9 +258,9 @@ PrimaryExpr:
 		UNIMPLEMENTED;
 	}
 	| FunctionExpr
-	/*| ClassExpr
+	/*| ClassExpr */
 	| GeneratorExpr
-	| AsyncFunctionExpr*/
+	| AsyncFunctionExpr
 	| RegularExprLiteral
 	| TemplateLiteral
 	;
@@ -643,13 +653,13 @@ UpdateExpr_NoBrace:
 UnaryExpr:
 	  UpdateExpr
 	| UnaryExpr_Common
-	/* | AwaitExpr */
+	| AwaitExpr
 	;
 
 UnaryExpr_NoBrace:
 	  UpdateExpr_NoBrace
 	| UnaryExpr_Common
-	/* | AwaitExpr_NoBrace */
+	| AwaitExpr
 	;
 
 UnaryExpr_Common:
@@ -963,9 +973,9 @@ AssignmentExpr:
 	  ConditionalExpr
 	// virtual | ObjectAssignmentPattern '=' AssignmentExpr
 	// virtual | ArrayAssignmentPattern '=' AssignmentExpr
-	// | YieldExpr
+	| YieldExpr
 	| ArrowFunction
-	// | AsyncArrowFunction
+	| AsyncArrowFunction
 	| LeftHandSideExpr '=' AssignmentExpr {
 		$$ = new AssignNode($1, $3);
 	}
@@ -977,9 +987,9 @@ AssignmentExpr:
 AssignmentExpr_NoBrace:
 	  ConditionalExpr_NoBrace
 	// | ArrayAssignmentPattern '=' AssignmentExpr
-	// | YieldExpr
+	| YieldExpr
 	| ArrowFunction
-	// | AsyncArrowFunction
+	| AsyncArrowFunction
 	| LeftHandSideExpr_NoBrace '=' AssignmentExpr {
 		$$ = new AssignNode($1, $3);
 	}
@@ -988,6 +998,26 @@ AssignmentExpr_NoBrace:
 	}
 	;
 
+/* 15.5 Generator Function Definitions (YieldExpression) */
+YieldExpr:
+	  YIELD {
+		$$ = new YieldNode(@1, NULL);
+	}
+	| YIELD AssignmentExpr {
+		$$ = new YieldNode(loc_from(@1, @2), $2);
+	}
+	| YIELD '*' AssignmentExpr {
+		UNIMPLEMENTED;
+	}
+	;
+
+/* 15.8 Async Function Definitions (AwaitExpression) */
+AwaitExpr:
+	  AWAIT UnaryExpr {
+		$$ = new AwaitNode(loc_from(@1, @2), $2);
+	}
+	;
+
 /* 12.15.5 Destructuring Assignment */
 /*
  * This grammar is 'covered' by the ObjectLiteral and ArrayLiteral nonterminals.
@@ -1290,7 +1320,7 @@ IterationStmt:
 	  DoWhileStmt
 	| WhileStmt
 	| ForStmt
-	//| ForInOfStmt
+	| ForInOfStmt
 	;
 
 DoWhileStmt: /* [Yield, Await, Return] */
@@ -1326,8 +1356,8 @@ ForStmt[Yield, Await, Return] :
 ForStmt: /* [Yield, Await, Return] */
 	  FOR '(' ExprOpt ';' ExprOpt ';' ExprOpt ')'
 	  Stmt {
-		$$ = new ForNode(loc_from(@1, @9), new ExprStmtNode($3), $5,
-		    $7);
+		$$ = new ForNode(loc_from(@1, @9), $3 ? new ExprStmtNode($3) :
+		    NULL, $5, $7, $9);
 	}
 	| FOR '(' VAR VariableDeclarationList ';' ExprOpt ';'
 	  ExprOpt ')' Stmt {
@@ -1349,7 +1379,7 @@ ForStmt: /* [Yield, Await, Return] */
 
 ExprOpt:
 	  Expr
-	| %empty
+	| %empty { $$ = NULL; }
 	;
 
 /*
@@ -1391,6 +1421,19 @@ ForBinding[Yield, Await] :
 	BindingPattern[?Yield, ?Await]
 */
 
+ForInOfStmt:
+	  FOR '(' LetOrConst ForBinding OF AssignmentExpr ')' Stmt {
+		$$ = new ForOfNode(loc_from(@1, @8), $4, $6, $8);
+	}
+	;
+
+ForBinding:
+	  BindingIdentifier { $$ = new SingleNameDestructuringNode($1); }
+	| BindingPattern {
+		UNIMPLEMENTED;
+	}
+	;
+
 ContinueStmt:
 	  CONTINUE ';' {
 		$$ = new ContinueNode(loc_from(@1, @2));
@@ -1453,27 +1496,45 @@ LabelledItem:
 	;
 
 ThrowStmt:
-	  THROW /* [no LineTerminator here] */ Expr ';'
+	  THROW /* [no LineTerminator here] */ Expr ';' {
+		$$ = new ThrowNode(loc_from(@1, @3), $2);
+	}
 	;
 
 TryStmt:
-	  TRY Block Catch
-	| TRY Block Finally
-	| TRY Block Catch Finally
+	  TRY Block Catch {
+		$$ = new TryNode(loc_from(@1, @3), $2, $3.param, $3.block,
+		    NULL);
+	}
+	| TRY Block Finally {
+		$$ = new TryNode(loc_from(@1, @3), $2, NULL, NULL, $3);
+	}
+	| TRY Block Catch Finally {
+		$$ = new TryNode(loc_from(@1, @4), $2, $3.param, $3.block,
+		    $4);
+	}
 	;
 
 Catch:
-	  CATCH '(' CatchParameter ')' Block
-	| CATCH Block
+	  CATCH '(' CatchParameter ')' Block {
+		$$.param = $3;
+		$$.block = $5;
+	}
+	| CATCH Block {
+		$$.param = NULL;
+		$$.block = $2;
+	}
 	;
 
 Finally:
-	  FINALLY Block
+	  FINALLY Block { $$ = $2; }
 	;
 
 CatchParameter:
-	  BindingIdentifier
-	| BindingPattern
+	  BindingIdentifier { $$ = new SingleNameDestructuringNode($1); }
+	| BindingPattern {
+		UNIMPLEMENTED;
+	}
 	;
 
 DebuggerStmt:
@@ -1574,6 +1635,7 @@ ConciseBody:
 		$$ = new StmtNode::Vec;
 		$$->push_back($1);
 	}
+	| '{' FunctionBody '}' { $$ = $2 ? $2 : new StmtNode::Vec; }
 	;
 
 ExpressionBody:
@@ -1595,6 +1657,44 @@ ArrowFormalParameters[Yield, Await] :
 	( UniqueFormalParameters[?Yield, ?Await] )
 */
 
+/* 15.4 Generator Function Definitions */
+
+GeneratorExpr:
+	  FUNCTION '*' BindingIdentifier_Str '(' FormalParameters ')' '{'
+	  FunctionBody '}' {
+		$$ = new FunctionExprNode(loc_from(@1, @9), $3, $5, $8,
+		    FunctionExprNode::kGenerator);
+	}
+	| FUNCTION '*' '(' FormalParameters ')' '{' FunctionBody '}' {
+		$$ = new FunctionExprNode(loc_from(@1, @8), NULL, $4, $7,
+		    FunctionExprNode::kGenerator);
+	}
+	;
+
+/* 15.8 Async Function Definitions */
+
+AsyncFunctionExpr:
+	  ASYNC FUNCTION BindingIdentifier_Str '(' FormalParameters ')' '{'
+	  FunctionBody '}' {
+		$$ = new FunctionExprNode(loc_from(@1, @9), $3, $5, $8,
+		    FunctionExprNode::kAsync);
+	}
+	| ASYNC FUNCTION '(' FormalParameters ')' '{' FunctionBody '}' {
+		$$ = new FunctionExprNode(loc_from(@1, @8), NULL, $4, $7,
+		    FunctionExprNode::kAsync);
+	}
+	;
+
+/* 15.9 Async Arrow Function Definitions */
+
+AsyncArrowFunction:
+	  ASYNC ArrowParameters /* [no LineTerminator here] */ FARROW
+	  ConciseBody {
+		$$ = new FunctionExprNode(loc_from(@1, @4), NULL, $2, $4,
+		    FunctionExprNode::kAsync);
+	}
+	;
+
 
 Script:
 	  ScriptBody { driver->m_script = new ScriptNode(@1, $1); }
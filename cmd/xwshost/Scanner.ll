@@ -37,6 +37,30 @@
 			loc->last_column++;       \
 	}                                         \
 	}
+
+/* Strip the quotes from a string literal and process its escapes. */
+static char *
+unescape(const char *lit)
+{
+	size_t len = strlen(lit) - 2;
+	char *str = (char *)malloc(len + 1), *out = str;
+
+	for (const char *in = lit + 1; in < lit + 1 + len; in++) {
+		if (*in != '\\') {
+			*out++ = *in;
+			continue;
+		}
+		switch (*++in) {
+		case 'n': *out++ = '\n'; break;
+		case 't': *out++ = '\t'; break;
+		case 'r': *out++ = '\r'; break;
+		default: *out++ = *in;
+		}
+	}
+	*out = '\0';
+
+	return str;
+}
 %}
 
 /* todo NBSP, ZWNBSP, USP */
@@ -55,6 +79,11 @@ IdentifierName {IdentifierStart}{IdentifierPart}*
 DecimalIntegerLiteral	0|([1-9][0-9]*)
 
 DecimalLiteral {DecimalIntegerLiteral}
+
+/* todo hex, unicode and line continuation escapes */
+DoubleStringCharacter	([^"\\\n\r]|\\.)
+SingleStringCharacter	([^'\\\n\r]|\\.)
+StringLiteral	(\"{DoubleStringCharacter}*\")|(\'{SingleStringCharacter}*\')
 %%
 
 {WhiteSpace}+		{}
@@ -144,4 +173,9 @@ DecimalLiteral {DecimalIntegerLiteral}
 	return NUMLIT;
 }
 
+{StringLiteral}	{
+	yylval->exprNode = new StringNode(*loc, unescape(yytext));
+	return STRINGLIT;
+}
+
 .	return (int)yytext[0];
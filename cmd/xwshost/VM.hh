@@ -11,26 +11,266 @@
 
 #include "ObjectMemory.hh"
 
+class EventLoop;
+
 namespace VM {
 
+/**
+ * Thrown out of Interpreter::interpret() when execution is terminated. Script
+ * code cannot catch it; the interpreter's stack and pending microtasks are
+ * discarded, and it is returned to the start of the script.
+ */
+struct Termination {
+	enum Kind {
+		kRequested,	    /**< by Interpreter::requestInterrupt() */
+		kInstructionBudget, /**< ResourceLimits::m_maxInstructions */
+		kHeapBudget,	    /**< ResourceLimits::m_maxBytesAllocated */
+		kDeadline,	    /**< ResourceLimits::m_maxMillis */
+		kHeapLimit,	    /**< by the HeapLimitCallback */
+	} m_kind;
+	const char *m_reason;
+
+	Termination(Kind kind, const char *reason)
+	    : m_kind(kind)
+	    , m_reason(reason) {};
+};
+
+/**
+ * Budgets for a run of Interpreter::interpret(); 0 means unlimited. They are
+ * checked at safepoints, so may be overrun by up to one safepoint interval.
+ */
+struct ResourceLimits {
+	/**
+	 * Bytecode executed, in bytes. Straight-line code is charged on
+	 * function entry by the length of the function, and loop bodies on
+	 * each back edge by their length.
+	 */
+	uint64_t m_maxInstructions;
+	/** Bytes allocated, whether or not they are still live. */
+	uint64_t m_maxBytesAllocated;
+	/** Wall-clock time. */
+	uint64_t m_maxMillis;
+
+	ResourceLimits()
+	    : m_maxInstructions(0)
+	    , m_maxBytesAllocated(0)
+	    , m_maxMillis(0) {};
+};
+
 class Interpreter {
+    public:
+	/** Requests which may be made of a running interpreter. */
+	enum Interrupt {
+		kInterruptTerminate = 1,
+		kInterruptGC = 2,
+		kInterruptSample = 4,
+	};
+
+    private:
 	ObjectMemoryOSThread &m_omemt;
 	std::vector<Oop> m_stack;
+	/** Adjacent, so as to be scanned as one root, #m_mpsRegsRoot. */
 	MemOop<Environment> m_env;
 	MemOop<Closure> m_closure;
+	/** The script and its environment, to which a Termination resets. */
+	MemOop<Closure> m_script;
+	MemOop<Environment> m_scriptEnv;
+	/**
+	 * What is thrown when an allocation fails, made in advance as there
+	 * is then no room to make it.
+	 */
+	PrimOop m_heapError;
 	mps_root_t m_mpsRoot;
+	mps_root_t m_mpsRegsRoot;
+	/**
+	 * The current function's bytecode and literals, which are within it.
+	 * It is in the code space, which never moves, so they are good across
+	 * collections.
+	 */
+	const char *m_code;
+	OopSlot<> *m_literals;
+
+	/**
+	 * The microtask queue: a ring of (target, argument) pairs, whose size
+	 * is a power of two. #m_mtHead and #m_mtTail count Oops queued and
+	 * consumed, and are masked to index it; it only grows when full, so
+	 * queueing and running microtasks allocates nothing. Consumed slots
+	 * are cleared so as not to keep garbage alive.
+	 */
+	std::vector<Oop> m_microtasks;
+	size_t m_mtHead, m_mtTail;
+	/** Where the batch being run ends; see runMicrotask(). */
+	size_t m_mtBatchEnd;
+	mps_root_t m_mpsMicrotasksRoot;
+
+	/** Host event loop polled once microtasks run out, or NULL. */
+	EventLoop *m_loop;
+	/** Whether the native function just called raised an exception. */
+	bool m_nativeThrew;
+	/**
+	 * Whether the top-level script has returned and the event loop is
+	 * running. Its value then sits at the bottom of the stack.
+	 */
+	bool m_draining;
 
 	/** base pointer: base of stack for current function */
 	unsigned int m_bp;
 	/** program counter */
 	unsigned int m_pc;
 
+	/**
+	 * Bytecode (in bytes) which may be executed until the next poll.
+	 * Safepoints are function entry and loop back edges; each deducts the
+	 * length of code it covers, and when this reaches zero the interpreter
+	 * drains GC messages, checks #m_limits and services #m_interrupts.
+	 * Other threads subtract kInterruptBias from it to have an interrupt
+	 * seen promptly, so what remains of the quantum is not lost.
+	 */
+	volatile int32_t m_safepointTicks;
+	/** What #m_safepointTicks was last reset to. */
+	int32_t m_safepointQuantum;
+	/** Pending #Interrupt bits; set by requestInterrupt(). */
+	volatile uint32_t m_interrupts;
+
+	ResourceLimits m_limits;
+	/** Bytecode executed in this run, as of the last poll. */
+	uint64_t m_instructions;
+	/** ObjectMemoryOSThread::bytesAllocated() when this run began. */
+	uint64_t m_bytesAllocatedBase;
+	/** CLOCK_MONOTONIC deadline for this run, in ms; 0 if none. */
+	uint64_t m_deadline;
+
+	/** Initial size of #m_microtasks, in Oops. */
+	static const size_t kMicrotasksInitial = 256;
+
+	/** Bytecode between polls when no limit is nearer. */
+	static const int32_t kSafepointInterval = 16384;
+	/**
+	 * Subtracted from #m_safepointTicks by requestInterrupt(); ticks
+	 * below -kInterruptBias / 2 are taken to be so biased.
+	 */
+	static const int32_t kInterruptBias = 1 << 30;
+
+	/**
+	 * Hotness (invocations plus back edges) at which a function becomes a
+	 * candidate for tiering up.
+	 */
+	static const int32_t kTierUpThreshold = 1000;
+
 	inline Oop push(Oop oop);
 	inline Oop pop();
 
+	/**
+	 * Bump the current function's hotness counter. \p loopHeader is the
+	 * target of the back edge being taken, or -1 for function entry.
+	 */
+	inline void countHotness(int32_t loopHeader);
+	void tierUp(MemOop<Function> fun, int32_t loopHeader);
+
+	/** The safepoint check: a single subtract and branch. */
+	inline void safepoint(int32_t cost);
+	void handleSafepoint();
+	void checkLimits();
+	void sampleStack();
+
+	/** Index of the first operand stack slot of the current frame. */
+	inline unsigned int frameBase() const;
+	/**
+	 * Call \p callee with the top \p nArgs stack slots as its arguments.
+	 * Returns false if that threw and there was no handler.
+	 */
+	bool call(Oop callee, uint8_t nArgs);
+	/** Make \p closure the current one. */
+	inline void setClosure(MemOop<Closure> closure);
+	/** Make the one closure of \p fun, which captures nothing. */
+	MemOop<Closure> makeStaticClosure(MemOop<Function> fun);
+	/** Enter a frame for \p closure, returning to the current pc. */
+	void pushFrame(MemOop<Closure> closure, MemOop<Environment> env);
+	/** Discard the current frame and resume its caller's state. */
+	void popFrame();
+	/**
+	 * Raise \p exc at the instruction just executed, unwinding to the
+	 * nearest handler. Returns false if there was none, in which case
+	 * execution is over.
+	 */
+	bool throwValue(Oop exc);
+	/** Raise a string made of \p msg followed by \p detail. */
+	bool throwError(const char *msg, const char *detail);
+
+	/**
+	 * Push a frame for \p act, returning to the current pc, and continue
+	 * it. \p sent is the value of the yield or await it is suspended at.
+	 */
+	void resume(MemOop<Activation> act, Oop sent);
+	/** Save the current generator or async frame and pop it. */
+	MemOop<Activation> suspend();
+	/** Complete the current generator or async frame with \p val. */
+	void finish(Oop val);
+	/** Have \p target run with \p promise once that is settled. */
+	void addReaction(MemOop<Promise> promise, Oop target);
+	/**
+	 * Start the next microtask, polling the event loop for more if there
+	 * are none. Returns false if there is nothing left to do.
+	 */
+	bool runMicrotask();
+
+	void run();
+	/** run(), raising allocation failures in the script. */
+	void runGuarded();
+
     public:
 	Interpreter(ObjectMemoryOSThread &omemt, MemOop<Closure> closure);
+	~Interpreter();
+
+	/**
+	 * Ask the interpreter to service \p what at its next safepoint,
+	 * waking its event loop if it is waiting. May be called from any
+	 * thread.
+	 */
+	void requestInterrupt(Interrupt what);
+
+	/** Have the event loop \p loop polled once microtasks run out. */
+	void setEventLoop(EventLoop *loop);
+
+	/**
+	 * Queue a microtask: \p target is run with \p arg. A Closure is called
+	 * with it; an Activation is resumed with it as the result of its
+	 * await; a Promise settles as \p arg is settled. If \p arg is itself
+	 * a Promise, which must be settled, its value or reason is used.
+	 */
+	void enqueueMicrotask(Oop target, Oop arg);
+
+	/**
+	 * Fulfil or reject \p promise with \p val, if it is still pending. A
+	 * promise fulfilled with another follows that one instead.
+	 */
+	void settle(MemOop<Promise> promise, Promise::State state, Oop val);
+
+	/**
+	 * For a native function to raise \p exc, as in
+	 * `return interp.nativeThrow(exc);`.
+	 */
+	inline Oop nativeThrow(Oop exc)
+	{
+		m_nativeThrew = true;
+		return exc;
+	}
+
+	inline ObjectMemoryOSThread &omemt() { return m_omemt; }
+	/** CLOCK_MONOTONIC deadline of the current run, in ms; 0 if none. */
+	inline uint64_t deadline() const { return m_deadline; }
+
+	/** Set the budgets for subsequent calls to interpret(). */
+	void setLimits(const ResourceLimits &limits);
 
+	/**
+	 * Run the script, then its microtasks and the event loop, to
+	 * completion. Throws #Termination if terminated at a safepoint or on
+	 * reaching the heap limit, having reset the interpreter so that it
+	 * may be called again to run the script afresh. An allocation that
+	 * otherwise fails there throws a RangeError at the instruction making
+	 * it.
+	 */
 	void interpret();
 };
 
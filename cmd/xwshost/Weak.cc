@@ -0,0 +1,187 @@
+#include "Object.inl.hh"
+#include "VM.hh"
+
+/*
+ * WeakMaps and FinalizationRegistries, like the arrays they refer to, are in
+ * the AWL pool, which does not move objects; so `this` and the arrays stay
+ * put across allocation, though the keys may not.
+ */
+
+/* Fibonacci hashing of the key's address, less its tag. */
+static inline size_t
+hash(Oop key, size_t size)
+{
+	return (size_t)(((uint64_t)(key.m_full >> 4) *
+	    0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+}
+
+size_t
+WeakMap::probe(Oop key)
+{
+	size_t size = m_keys->m_length, free = size;
+
+	for (size_t i = hash(key, size);; i = (i + 1) & (size - 1)) {
+		Oop k = m_keys->m_elements[i];
+
+		if (k.m_full == key.m_full)
+			return i;
+		else if (k.isUndefined())
+			return free != size ? free : i;
+		else if (k.m_full == ObjectMemory::s_null.m_full &&
+		    free == size)
+			free = i;
+	}
+}
+
+size_t
+WeakMap::find(ObjectMemoryOSThread &omemt, Oop &key)
+{
+	mps_arena_t arena = omemt.omem().arena();
+	size_t i = probe(key);
+
+	if (m_keys->m_elements[i].m_full != key.m_full &&
+	    mps_ld_isstale(&m_ld, arena, key.addrT<void>())) {
+		HandleScope scope(omemt);
+		Handle<> hKey(omemt, key);
+
+		rehash(omemt, m_keys->m_length);
+		key = *hKey;
+		i = probe(key);
+	}
+
+	return i;
+}
+
+void
+WeakMap::rehash(ObjectMemoryOSThread &omemt, size_t size)
+{
+	HandleScope scope(omemt);
+	Handle<WeakArray> keys(omemt, omemt.makeWeakArray(size, true));
+	Handle<WeakArray> values(omemt, omemt.makeWeakArray(size, false));
+	MemOop<WeakArray> oldKeys = m_keys, oldValues = m_values;
+
+	keys->m_dependent = &**values;
+	m_keys = keys;
+	m_values = values;
+	m_used = 0;
+	mps_ld_reset(&m_ld, omemt.omem().arena());
+
+	for (size_t i = 0; i < oldKeys->m_length; i++) {
+		Oop key = oldKeys->m_elements[i];
+		size_t j;
+
+		if (key.isUndefined() ||
+		    key.m_full == ObjectMemory::s_null.m_full)
+			continue;
+
+		j = probe(key);
+		m_keys->m_elements[j] = key;
+		m_values->m_elements[j] = oldValues->m_elements[i];
+		mps_ld_add(&m_ld, omemt.omem().arena(), key.addrT<void>());
+		m_used++;
+	}
+}
+
+Oop
+WeakMap::get(ObjectMemoryOSThread &omemt, Oop key)
+{
+	size_t i = find(omemt, key);
+
+	return m_keys->m_elements[i].m_full == key.m_full ?
+	    m_values->m_elements[i] : ObjectMemory::s_undefined;
+}
+
+bool
+WeakMap::has(ObjectMemoryOSThread &omemt, Oop key)
+{
+	return m_keys->m_elements[find(omemt, key)].m_full == key.m_full;
+}
+
+void
+WeakMap::set(ObjectMemoryOSThread &omemt, Oop key, Oop val)
+{
+	HandleScope scope(omemt);
+	Handle<> hVal(omemt, val);
+	size_t i = find(omemt, key);
+	Handle<> hKey(omemt, key);
+
+	if (m_keys->m_elements[i].m_full == key.m_full) {
+		m_values->m_elements[i] = *hVal;
+		return;
+	}
+
+	if ((m_used + 1) * 4 > m_keys->m_length * 3) {
+		rehash(omemt, m_keys->m_length * 2);
+		i = probe(*hKey);
+	}
+
+	if (m_keys->m_elements[i].isUndefined())
+		m_used++;
+	m_keys->m_elements[i] = *hKey;
+	m_values->m_elements[i] = *hVal;
+	mps_ld_add(&m_ld, omemt.omem().arena(), (*hKey).addrT<void>());
+}
+
+bool
+WeakMap::remove(ObjectMemoryOSThread &omemt, Oop key)
+{
+	size_t i = find(omemt, key);
+
+	if (m_keys->m_elements[i].m_full != key.m_full)
+		return false;
+
+	m_keys->m_elements[i] = ObjectMemory::s_null;
+	m_values->m_elements[i] = ObjectMemory::s_undefined;
+	return true;
+}
+
+void
+FinalizationRegistry::add(ObjectMemoryOSThread &omemt, Oop target, Oop held)
+{
+	size_t size = m_targets->m_length;
+
+	while (m_hint < size && !m_targets->m_elements[m_hint].isUndefined())
+		m_hint++;
+
+	if (m_hint == size) {
+		HandleScope scope(omemt);
+		Handle<> hTarget(omemt, target), hHeld(omemt, held);
+		Handle<WeakArray> targets(omemt, omemt.makeWeakArray(size * 2,
+		    true));
+		Handle<WeakArray> helds(omemt, omemt.makeWeakArray(size * 2,
+		    false));
+
+		for (size_t i = 0; i < size; i++) {
+			targets->m_elements[i] = m_targets->m_elements[i];
+			helds->m_elements[i] = m_held->m_elements[i];
+		}
+		m_targets = targets;
+		m_held = helds;
+		target = *hTarget;
+		held = *hHeld;
+	}
+
+	m_targets->m_elements[m_hint] = target;
+	m_held->m_elements[m_hint++] = held;
+}
+
+size_t
+FinalizationRegistry::cleanup(VM::Interpreter &interp)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < m_targets->m_length; i++) {
+		if (m_targets->m_elements[i].m_full !=
+		    ObjectMemory::s_null.m_full)
+			continue;
+
+		interp.enqueueMicrotask(m_callback, m_held->m_elements[i]);
+		m_targets->m_elements[i] = ObjectMemory::s_undefined;
+		m_held->m_elements[i] = ObjectMemory::s_undefined;
+		if (i < m_hint)
+			m_hint = i;
+		n++;
+	}
+
+	return n;
+}
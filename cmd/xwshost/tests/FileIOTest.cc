@@ -0,0 +1,123 @@
+/*
+ * Writes a string to a temporary file with writeFile(), reads it back with
+ * readFile(), and writes the buffer read to a second file, then checks that
+ * both files hold the string: once through io_uring, where the kernel allows
+ * it, and once through the synchronous fallback.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include "Driver.hh"
+#include "Scanner.ll.hh"
+#include "AST.hh"
+#include "EventLoop.hh"
+#include "VM.hh"
+
+/* Spans several pages, and has no characters a string literal would need */
+static const size_t kTextLength = 100000;
+
+static std::string
+tempFile()
+{
+	const char *tmpdir = getenv("TMPDIR");
+	std::string path(tmpdir ? tmpdir : "/tmp");
+	int fd;
+
+	path += "/xwsfileio.XXXXXX";
+	fd = mkstemp(&path[0]);
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	close(fd);
+
+	return path;
+}
+
+static bool
+holds(const std::string &path, const std::string &text)
+{
+	std::ifstream f(path.c_str(), std::ios::binary);
+	std::stringstream ss;
+
+	ss << f.rdbuf();
+	return ss.str() == text;
+}
+
+/*
+ * The paths and the string are spelt out in the script, as its only globals
+ * are those of the event loop.
+ */
+static bool
+run(ObjectMemoryOSThread &omemt, bool useRing, const std::string &text)
+{
+	const char *how = useRing ? "io_uring" : "synchronous";
+	std::string first = tempFile(), second = tempFile();
+	std::string src = "const go = async () => {\n"
+	    "	await writeFile(\"" + first + "\", \"" + text + "\");\n"
+	    "	const buf = await readFile(\"" + first + "\");\n"
+	    "	await writeFile(\"" + second + "\", buf);\n"
+	    "};\n"
+	    "go();\n"
+	    "return 0;\n";
+	Driver drv(omemt);
+	bool ok = true;
+
+	jslex_init_extra(&drv, &drv.scanner);
+	js_scan_string(src.c_str(), drv.scanner);
+	drv.txt = src.c_str();
+	if (jsparse(&drv)) {
+		printf("%s: the script did not parse\n", how);
+		return false;
+	}
+	jslex_destroy(drv.scanner);
+
+	{
+		EventLoop loop(omemt, useRing);
+		HandleScope scope(omemt);
+		Handle<Function> script(omemt, drv.generateBytecode());
+		Handle<Environment> globals(omemt, loop.makeGlobals());
+		VM::Interpreter interp(omemt,
+		    omemt.makeClosure(script, globals));
+
+		interp.setEventLoop(&loop);
+		interp.interpret();
+	}
+
+	if (!holds(first, text)) {
+		printf("%s: the file written does not hold the string\n", how);
+		ok = false;
+	}
+	if (!holds(second, text)) {
+		printf("%s: the buffer read back does not hold the string\n",
+		    how);
+		ok = false;
+	}
+	unlink(first.c_str());
+	unlink(second.c_str());
+
+	return ok;
+}
+
+int
+main()
+{
+	void *marker = &marker;
+	ObjectMemory omem;
+	ObjectMemoryOSThread omemt(omem, marker);
+	std::string text;
+	bool ok;
+
+	for (size_t i = 0; i < kTextLength; i++)
+		text += 'a' + i % 26;
+
+	ok = run(omemt, true, text);
+	ok = run(omemt, false, text) && ok;
+
+	return ok ? 0 : 1;
+}